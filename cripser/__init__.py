@@ -6,16 +6,21 @@ stable import path ``cripser.computePH`` and provides helpers in
 """
 
 from .utils import *
-from ._cripser import computePH, __version__  # type: ignore
+from ._cripser import computePH, computePH_batch, computePH_async, set_async_pool, __version__  # type: ignore
 try:
     from tcripser import computePH as computePH_T
+    from tcripser import computePH_batch as computePH_batch_T
+    from tcripser import computePH_async as computePH_async_T
 except ImportError:
     ValueError(
         "tcripser is not installed. Please install it to use the T-construction."
     )
 
 __all__ = ["computePH", "computePH_T",
-    "__version__", "compute_ph",
+    "computePH_batch", "computePH_batch_T",
+    "computePH_async", "computePH_async_T", "set_async_pool",
+    "__version__", "compute_ph", "compute_ph_batch", "compute_ph_async", "Engine",
     "to_gudhi_diagrams",
     "to_gudhi_persistence",
-    "group_by_dim"]
+    "group_by_dim",
+    "to_structured"]
@@ -2,8 +2,9 @@
 Utilities for CubicalRipser's pybind modules under `cripser.utils`.
 
 This submodule provides helpers to:
-- Compute persistent homology via `cripser` or `tcripser`.
+- Compute persistent homology via `cripser` or `tcripser` (of an image, or of each image of a stack).
 - Convert the returned array (n, 9) into GUDHI-compatible representations.
+- Convert it into a compact structured array (`to_structured`).
 
 Columns of `computePH` output:
     [dim, birth, death, b_x, b_y, b_z, d_x, d_y, d_z]
@@ -17,13 +18,18 @@ Infinite deaths (encoded internally as DBL_MAX) are converted to numpy.inf.
 
 from __future__ import annotations
 
-from typing import List, Sequence, Tuple, Union
+from typing import Callable, List, Sequence, Tuple, Union
 
+import concurrent.futures
 import importlib
 import numpy as np
-from ._cripser import computePH, __version__  # type: ignore
+from ._cripser import computePH, computePH_batch, computePH_async, set_async_pool, __version__  # type: ignore
+from ._cripser import Engine as _Engine_V  # type: ignore
 try:
     from tcripser import computePH as computePH_T
+    from tcripser import computePH_batch as computePH_batch_T
+    from tcripser import computePH_async as computePH_async_T
+    from tcripser import Engine as _Engine_T
 except ImportError:
     ValueError(
         "tcripser is not installed. Please install it to use the T-construction."
@@ -32,7 +38,8 @@ except ImportError:
 ArrayLike = Union[np.ndarray, Sequence[float], Sequence[Sequence[float]]]
 
 
-_INF_CUTOFF = np.finfo(np.float64).max / 2.0  # heuristic to detect DBL_MAX
+_DBL_MAX = np.finfo(np.float64).max  # no threshold
+_INF_CUTOFF = _DBL_MAX / 2.0  # heuristic to detect DBL_MAX
 
 
 def compute_ph(
@@ -44,23 +51,171 @@ def compute_ph(
     top_dim: bool = False,
     embedded: bool = False,
     location: str = "yes",
+    mask: np.ndarray | None = None,
+    threshold: float = _DBL_MAX,
+    method: str = "link_find",
+    cache_size: int | str | None = None,
+    min_recursion_to_cache: int = 0,
+    maxiter: int = 1000000,
+    memory_budget: float = 1024,
+    threads: int = 0,
+    on_pairs: Callable[[int, np.ndarray], None] | None = None,
 ) -> np.ndarray:
     """Compute persistent homology using `cripser` or `tcripser`.
 
     Parameters
-    - arr: numpy array (1D/2D/3D/4D) of dtype float64
+    - arr: numpy array (1D/2D/3D/4D) or a CPU tensor with ``__dlpack__`` (PyTorch, JAX, ...);
+      bool, (u)int8 to (u)int64, float32 and float64 data are read in place (with any strides),
+      other dtypes are converted to float64
     - module: "_cripser" (V-construction) or "tcripser" (T-construction)
-    - maxdim, top_dim, embedded, location: forwarded to the pybind function
+    - maxdim, top_dim, embedded: forwarded to the pybind function
+    - location: "yes" or "none" (only the columns [dim, birth, death])
+    - mask: optional array of the same shape as ``arr``; only the voxels where it is
+      nonzero are included. This is a bounding-box crop: the grid covers the bounding box
+      of the mask, and the masked-out voxels inside it are still stored
+    - threshold: cells with values above it are left out (as ``--threshold``)
+    - method: "link_find" or "compute_pairs" (for dimension 0; as ``--algorithm``)
+    - cache_size: maximum number of reduced columns to be cached (None: no bound), or "auto"
+      to choose it and ``min_recursion_to_cache`` for each dimension from the number of columns
+      and ``memory_budget`` (MB)
+    - min_recursion_to_cache, maxiter: as ``--min_recursion_to_cache`` and ``--maxiter``
+    - threads: number of threads for sorting and enumerating cells (0: all hardware threads)
+    - on_pairs: optional callback ``on_pairs(dim, rows)`` receiving the rows of each dimension as soon as
+      it is done (e.g. H0 long before H2); a dimension with many pairs arrives in several calls
+      of about a million rows. The rows are also part of the returned array.
 
     Returns
     - np.ndarray of shape (n, 9): columns are
-      [dim, birth, death, b_x, b_y, b_z, d_x, d_y, d_z]
+      [dim, birth, death, b_x, b_y, b_z, d_x, d_y, d_z];
+      (n, 11) for 4D input (with b_w and d_w), and (n, 3) with ``location="none"``
+      ([dim, birth, death] only; earlier versions ignored ``location`` and returned 9 columns)
     """
-    if arr.dtype != np.float64:
-        arr = arr.astype(np.float64, copy=False)
     #mod = importlib.import_module(module)
     func = computePH_T if filtration.upper() == "T" else computePH
-    return func(arr, maxdim=maxdim, top_dim=top_dim, embedded=embedded, location=location)
+    return func(arr, maxdim=maxdim, top_dim=top_dim, embedded=embedded, location=location, mask=mask,
+                threshold=threshold, method=method, cache_size=cache_size,
+                min_recursion_to_cache=min_recursion_to_cache, maxiter=maxiter,
+                memory_budget=memory_budget, threads=threads, on_pairs=on_pairs)
+
+
+def compute_ph_batch(
+    arr: np.ndarray,
+    *,
+    filtration: str = "V",
+    maxdim: int = 3,
+    top_dim: bool = False,
+    embedded: bool = False,
+    threads: int = 0,
+    location: str = "yes",
+    threshold: float = _DBL_MAX,
+    method: str = "link_find",
+    cache_size: int | str | None = None,
+    min_recursion_to_cache: int = 0,
+    maxiter: int = 1000000,
+    memory_budget: float = 1024,
+) -> Tuple[np.ndarray, np.ndarray]:
+    """Compute persistent homology of each image ``arr[i]`` of a stack on a native thread pool.
+
+    Parameters
+    - arr: numpy array of shape (N, ...) holding N images of the same shape (1D/2D/3D/4D)
+    - filtration, maxdim, top_dim, embedded: as in ``compute_ph``
+    - threads: number of threads (0: all hardware threads)
+    - location, threshold, method, cache_size, min_recursion_to_cache, maxiter, memory_budget:
+      as in ``compute_ph`` (the memory budget is that of each thread)
+
+    Returns
+    - (ph, offsets): ph holds the rows of all the images in order (columns as in ``compute_ph``),
+      and those of ``arr[i]`` are ``ph[offsets[i]:offsets[i+1]]``
+    """
+    func = computePH_batch_T if filtration.upper() == "T" else computePH_batch
+    return func(arr, maxdim=maxdim, top_dim=top_dim, embedded=embedded, threads=threads,
+                location=location, threshold=threshold, method=method, cache_size=cache_size,
+                min_recursion_to_cache=min_recursion_to_cache, maxiter=maxiter,
+                memory_budget=memory_budget)
+
+
+def compute_ph_async(
+    arr: np.ndarray,
+    *,
+    filtration: str = "V",
+    maxdim: int = 3,
+    top_dim: bool = False,
+    embedded: bool = False,
+    location: str = "yes",
+    mask: np.ndarray | None = None,
+    threshold: float = _DBL_MAX,
+    method: str = "link_find",
+    cache_size: int | str | None = None,
+    min_recursion_to_cache: int = 0,
+    maxiter: int = 1000000,
+    memory_budget: float = 1024,
+) -> concurrent.futures.Future:
+    """Compute persistent homology on a native worker pool, without blocking.
+
+    Returns at once a ``concurrent.futures.Future`` of the result of ``compute_ph`` with the same
+    arguments (in an asyncio event loop, ``await asyncio.wrap_future(future)``).
+    The images are computed by native threads, one image per thread, so that no Python thread is needed.
+    At most ``max_queue`` images wait for a thread (see ``set_async_pool``; ``tcripser.set_async_pool`` for
+    the T-construction); the call blocks until there is room.
+    """
+    func = computePH_async_T if filtration.upper() == "T" else computePH_async
+    return func(arr, maxdim=maxdim, top_dim=top_dim, embedded=embedded, location=location, mask=mask,
+                threshold=threshold, method=method, cache_size=cache_size,
+                min_recursion_to_cache=min_recursion_to_cache, maxiter=maxiter,
+                memory_budget=memory_budget)
+
+
+class Engine:
+    """Persistent homology of image after image of a fixed shape, reusing the working space.
+
+    An engine is made for the shape and the settings of ``compute_ph`` once, and keeps all that the
+    computation allocates (the grid, the union-find, the cells to reduce, the pivot table and the cache
+    of the reduction, the coboundary tables) for the next image. Calls of ``compute`` on an engine run
+    one at a time; use an engine for each thread to compute in parallel. ``compute`` must not be called
+    on the same engine from its own ``on_pairs`` callback: that raises RuntimeError.
+
+    Parameters
+    - shape: shape of the images (1D/2D/3D/4D)
+    - maxdim: as in ``compute_ph``
+    - construction: "V" or "T" (as ``filtration`` of ``compute_ph``)
+    - top_dim, embedded, location, threshold, method, cache_size, min_recursion_to_cache, maxiter,
+      memory_budget, threads: as in ``compute_ph``
+    """
+
+    def __init__(
+        self,
+        shape: Sequence[int],
+        maxdim: int = 3,
+        construction: str = "V",
+        *,
+        top_dim: bool = False,
+        embedded: bool = False,
+        location: str = "yes",
+        threshold: float = _DBL_MAX,
+        method: str = "link_find",
+        cache_size: int | str | None = None,
+        min_recursion_to_cache: int = 0,
+        maxiter: int = 1000000,
+        memory_budget: float = 1024,
+        threads: int = 0,
+    ) -> None:
+        cls = _Engine_T if construction.upper() == "T" else _Engine_V
+        self.construction = construction.upper()
+        self._engine = cls(tuple(int(s) for s in shape), maxdim=maxdim, top_dim=top_dim, embedded=embedded,
+                           location=location, threshold=threshold, method=method, cache_size=cache_size,
+                           min_recursion_to_cache=min_recursion_to_cache, maxiter=maxiter,
+                           memory_budget=memory_budget, threads=threads)
+
+    @property
+    def shape(self) -> Tuple[int, ...]:
+        return self._engine.shape
+
+    def compute(self, arr: np.ndarray, *, on_pairs: Callable[[int, np.ndarray], None] | None = None) -> np.ndarray:
+        """The result of ``compute_ph`` of ``arr`` (of the shape of the engine) with the settings of the engine.
+
+        Raises RuntimeError if called from ``on_pairs`` of a computation of the same engine.
+        """
+        return self._engine.compute(arr, on_pairs=on_pairs)
 
 
 def _as_2col_pairs(bd: np.ndarray) -> np.ndarray:
@@ -139,17 +294,48 @@ def group_by_dim(ph: np.ndarray) -> List[np.ndarray]:
     """Group full rows by homology dimension.
 
     Parameters
-    - ph: array of shape (n, 9) from `computePH`.
+    - ph: array of shape (n, 3), (n, 9) or (n, 11) from `computePH`.
 
     Returns
-    - List of subarrays (each with the same 9 columns), ordered by increasing dimension.
+    - List of subarrays (each with the same columns), ordered by increasing dimension.
     """
     a = np.asarray(ph)
-    if a.ndim != 2 or a.shape[1] != 9:
-        raise ValueError("Expected (n, 9) array from computePH")
+    if a.ndim != 2 or a.shape[1] not in (3, 9, 11):
+        raise ValueError("Expected (n, 3), (n, 9) or (n, 11) array from computePH")
     dims = a[:, 0].astype(int, copy=False)
     maxdim = int(dims.max()) if a.size else 0
     groups: List[np.ndarray] = []
     for k in range(maxdim + 1):
         groups.append(a[dims == k])
     return groups
+
+
+def to_structured(ph: np.ndarray, *, float32: bool = False) -> np.ndarray:
+    """Convert CubicalRipser output to a structured array (the layout of ``--npy_layout structured``).
+
+    Parameters
+    - ph: array of shape (n, 3), (n, 9) or (n, 11) from `computePH`.
+    - float32: store birth and death as float32 (DBL_MAX becomes inf) instead of float64.
+
+    Returns
+    - np.ndarray of shape (n,) with fields dim (uint8), birth, death, and the
+      coordinates x1, y1, z1[, w1], x2, y2, z2[, w2] (int16, or int32 when they do not fit).
+    """
+    a = np.asarray(ph)
+    if a.ndim != 2 or a.shape[1] not in (3, 9, 11):
+        raise ValueError("Expected (n, 3), (n, 9) or (n, 11) array from computePH")
+    value = np.float32 if float32 else np.float64
+    coords = {9: ["x1", "y1", "z1", "x2", "y2", "z2"],
+              11: ["x1", "y1", "z1", "w1", "x2", "y2", "z2", "w2"]}.get(a.shape[1], [])
+    loc = a[:, 3:]
+    fits16 = loc.size == 0 or (loc.min() >= np.iinfo(np.int16).min and loc.max() <= np.iinfo(np.int16).max)
+    coord = np.int16 if fits16 else np.int32
+    dtype = [("dim", np.uint8), ("birth", value), ("death", value)] + [(c, coord) for c in coords]
+    out = np.empty(a.shape[0], dtype=dtype)
+    out["dim"] = a[:, 0]
+    with np.errstate(over="ignore"):
+        out["birth"] = a[:, 1]
+        out["death"] = a[:, 2]
+    for k, c in enumerate(coords):
+        out[c] = a[:, 3 + k]
+    return out
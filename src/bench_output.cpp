@@ -0,0 +1,105 @@
+/* bench_output.cpp
+
+Benchmark of the CSV output: the former ostream path against formatCSV
+(single-threaded and in parallel parts).
+
+usage: bench_output [number of pairs (default 10000000)] [output file (default /dev/null)] [threads (default 0: all)]
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#include "write_pairs.h"
+#include "pair_writer.h"
+#include "parallel.h"
+
+using namespace std;
+
+namespace {
+
+double seconds_since(chrono::steady_clock::time_point t) {
+	return chrono::duration<double>(chrono::steady_clock::now() - t).count();
+}
+
+// the output loop before formatCSV
+void write_ostream(const vector<ResolvedPair>& pairs, ostream& out) {
+	for (const auto& pair : pairs) {
+		out << static_cast<unsigned int>(pair.dim) << "," << pair.birth << "," << pair.death;
+		out << "," << pair.birth_x << "," << pair.birth_y << "," << pair.birth_z;
+		out << "," << pair.death_x << "," << pair.death_y << "," << pair.death_z;
+		out << '\n';
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const size_t n = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 10000000;
+	const string filename = (argc > 2) ? argv[2] : "/dev/null";
+	const unsigned num_threads = resolve_threads((argc > 3) ? atoi(argv[3]) : 0);
+
+	mt19937_64 rng(0);
+	uniform_real_distribution<double> value(0.0, 1.0);
+	uniform_int_distribution<int64_t> coord(0, 511);
+	vector<ResolvedPair> pairs(n);
+	for (auto& p : pairs) {
+		p.dim = static_cast<uint8_t>(rng() % 3);
+		p.birth = value(rng);
+		p.death = p.birth + value(rng);
+		p.birth_x = coord(rng); p.birth_y = coord(rng); p.birth_z = coord(rng); p.birth_w = 0;
+		p.death_x = coord(rng); p.death_y = coord(rng); p.death_z = coord(rng); p.death_w = 0;
+	}
+	cout << n << " pairs, " << num_threads << " threads, writing to " << filename << endl;
+
+	{
+		ofstream out(filename);
+		const auto t = chrono::steady_clock::now();
+		write_ostream(pairs, out);
+		out.flush();
+		cout << "ostream:            " << seconds_since(t) << " [sec]" << endl;
+	}
+	{
+		ofstream out(filename, ios::binary);
+		const auto t = chrono::steady_clock::now();
+		string s;
+		for (size_t b = 0; b < n; b += PairWriter::CHUNK) {
+			s.clear();
+			formatCSV(pairs.data() + b, min(PairWriter::CHUNK, n - b), true, false, s);
+			out.write(s.data(), static_cast<streamsize>(s.size()));
+		}
+		out.flush();
+		cout << "formatCSV:          " << seconds_since(t) << " [sec]" << endl;
+	}
+	{
+		ofstream out(filename, ios::binary);
+		const auto t = chrono::steady_clock::now();
+		vector<string> parts(num_threads);
+		for (size_t b = 0; b < n; b += PairWriter::CHUNK) {
+			const size_t m = min(PairWriter::CHUNK, n - b);
+			const unsigned nt = parallel_chunks(m, num_threads, [&](unsigned i, size_t lo, size_t hi) {
+				parts[i].clear();
+				formatCSV(pairs.data() + b + lo, hi - lo, true, false, parts[i]);
+			});
+			for (unsigned i = 0; i < nt; ++i) out.write(parts[i].data(), static_cast<streamsize>(parts[i].size()));
+		}
+		out.flush();
+		cout << "formatCSV parallel: " << seconds_since(t) << " [sec]" << endl;
+	}
+	return 0;
+}
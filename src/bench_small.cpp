@@ -0,0 +1,92 @@
+/* bench_small.cpp
+
+Benchmark of the computation of many small 2D images (as those of MNIST): images per second on a
+single thread, with the grid and working space allocated for each image and kept in a PHWorkspace.
+The images are random, with float values and with 8-bit integer values.
+The rate is that of the fastest round of NUM_IMAGES images, which other load on the machine slows down least.
+
+usage: bench_small [seconds per case (default 1)] [maxdim (default 1)]
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include "compute_ph.h"
+
+using namespace std;
+
+namespace {
+
+constexpr size_t NUM_IMAGES = 64; // distinct images, computed in turn
+
+double seconds_since(chrono::steady_clock::time_point t) {
+	return chrono::duration<double>(chrono::steady_clock::now() - t).count();
+}
+
+// images per second in the fastest round of computing the images in turn, over about the given time
+// (with the workspace kept from an image for the next if reuse)
+double images_per_second(const vector<double>& images, uint32_t size, const Config& config, bool reuse, double seconds) {
+	const size_t voxels = static_cast<size_t>(size) * size;
+	PHWorkspace kept;
+	double fastest = 0;
+	const auto start = chrono::steady_clock::now();
+	while (seconds_since(start) < seconds || fastest == 0) {
+		const auto round = chrono::steady_clock::now();
+		for (size_t i = 0; i < NUM_IMAGES; ++i) {
+			PHWorkspace fresh;
+			PHWorkspace& ws = reuse ? kept : fresh;
+			DenseCubicalGrids* dcg = ws.grid(config, 2, size, size);
+			dcg->gridFromArray(images.data() + i * voxels, false, false);
+			dcg->finalisePadding();
+			RowBuffer rows(9);
+			ws.computeRows(rows);
+		}
+		fastest = max(fastest, static_cast<double>(NUM_IMAGES) / seconds_since(round));
+	}
+	return fastest;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+	const int maxdim = (argc > 2) ? atoi(argv[2]) : 1;
+
+	Config config;
+	config.maxdim = static_cast<uint8_t>(maxdim);
+	config.num_threads = imageThreads(28 * 28, 0);
+
+	mt19937_64 rng(0);
+	uniform_real_distribution<double> value(0.0, 1.0);
+	uniform_int_distribution<int> byte(0, 255);
+
+	printf("%-8s %-6s %14s %14s\n", "size", "values", "fresh/s", "workspace/s");
+	for (uint32_t size : {28u, 64u}) {
+		for (bool bytes : {false, true}) {
+			vector<double> images(NUM_IMAGES * size * size);
+			for (auto& v : images) v = bytes ? byte(rng) : value(rng);
+			const double fresh = images_per_second(images, size, config, false, seconds);
+			const double kept = images_per_second(images, size, config, true, seconds);
+			printf("%-8s %-6s %14.0f %14.0f\n", (to_string(size) + "x" + to_string(size)).c_str(),
+				bytes ? "uint8" : "float", fresh, kept);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+/* byte_reader.h
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "mapped_file.h"
+
+// Build with CRIPSER_HAS_ZLIB (and -lz) to read gzip-compressed files and deflated .npz members
+#ifdef CRIPSER_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+// Sequential reader of the bytes of a region of a mapped file, inflating them on the fly if compressed.
+// Compressed data are inflated straight into the caller's buffer; the kernel reads the mapped file
+// ahead (see MappedFile) while the data are inflated.
+class ByteReader {
+public:
+	enum encoding { STORED, GZIP, DEFLATE }; // DEFLATE: raw deflate stream (zip members)
+
+	ByteReader(const char* data, size_t size, encoding enc) : p(data), end(data + size), enc_(enc) {
+		if (enc_ == STORED) return;
+#ifdef CRIPSER_HAS_ZLIB
+		memset(&zs, 0, sizeof(zs));
+		// 15 + 16: gzip wrapper; -15: no wrapper
+		if (inflateInit2(&zs, enc_ == GZIP ? 15 + 16 : -15) != Z_OK) {
+			throw std::runtime_error("Failed to initialise zlib");
+		}
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+#else
+		throw std::runtime_error("Compressed input is not supported (build with zlib)");
+#endif
+	}
+
+	~ByteReader() {
+#ifdef CRIPSER_HAS_ZLIB
+		if (enc_ != STORED) inflateEnd(&zs);
+#endif
+	}
+
+	ByteReader(const ByteReader&) = delete;
+	ByteReader& operator=(const ByteReader&) = delete;
+
+	// the next n bytes in place (nullptr when the data are compressed)
+	const char* view(size_t n) {
+		if (enc_ != STORED) return nullptr;
+		if (static_cast<size_t>(end - p) < n) throw std::runtime_error("Unexpected end of data");
+		const char* v = p;
+		p += n;
+		return v;
+	}
+
+	// copy (or inflate) the next n bytes to out
+	void read(void* out, size_t n) {
+		if (enc_ == STORED) {
+			memcpy(out, view(n), n);
+			return;
+		}
+#ifdef CRIPSER_HAS_ZLIB
+		auto* dst = static_cast<Bytef*>(out);
+		while (n > 0) {
+			// zlib counts in 32-bit units
+			const uInt out_chunk = static_cast<uInt>(std::min<size_t>(n, UINT_MAX));
+			const size_t left = static_cast<size_t>(end - p);
+			zs.avail_in = static_cast<uInt>(std::min<size_t>(left, UINT_MAX));
+			zs.next_out = dst;
+			zs.avail_out = out_chunk;
+			const int ret = inflate(&zs, Z_NO_FLUSH);
+			const size_t produced = out_chunk - zs.avail_out;
+			p = reinterpret_cast<const char*>(zs.next_in);
+			dst += produced;
+			n -= produced;
+			if ((ret == Z_STREAM_END || (ret == Z_BUF_ERROR && p == end)) && n > 0) {
+				throw std::runtime_error("Unexpected end of compressed data");
+			}
+			if (ret != Z_OK && ret != Z_STREAM_END) {
+				throw std::runtime_error("Corrupt compressed data");
+			}
+		}
+#endif
+	}
+
+private:
+	const char* p;
+	const char* end;
+	encoding enc_;
+#ifdef CRIPSER_HAS_ZLIB
+	z_stream zs;
+#endif
+};
+
+// The member of a .npz archive (a zip file) holding the array: "arr_0.npy" if present, the first .npy otherwise.
+// Sets data and size to the (possibly compressed) content of the member in the mapped file.
+inline void findNpzMember(const MappedFile& file, const char*& data, size_t& size, ByteReader::encoding& enc) {
+	const auto* b = reinterpret_cast<const unsigned char*>(file.data());
+	const size_t n = file.size();
+	auto u16 = [&](size_t i) -> uint64_t {
+		if (i + 2 > n) throw std::runtime_error("Corrupt npz file");
+		return b[i] | (uint64_t(b[i + 1]) << 8);
+	};
+	auto u32 = [&](size_t i) -> uint64_t { return u16(i) | (u16(i + 2) << 16); };
+	auto u64 = [&](size_t i) -> uint64_t { return u32(i) | (u32(i + 4) << 32); };
+
+	// end of central directory record (followed by a comment of up to 64KB)
+	if (n < 22) throw std::runtime_error("Corrupt npz file");
+	size_t eocd = n - 22;
+	while (u32(eocd) != 0x06054b50) {
+		if (eocd == 0 || n - eocd > 22 + 0xffff) throw std::runtime_error("Corrupt npz file");
+		--eocd;
+	}
+	uint64_t entries = u16(eocd + 10);
+	uint64_t dir = u32(eocd + 16);
+	// zip64 end of central directory (written for large archives)
+	if ((entries == 0xffff || dir == 0xffffffff) && eocd >= 20 && u32(eocd - 20) == 0x07064b50) {
+		const size_t eocd64 = u64(eocd - 20 + 8);
+		entries = u64(eocd64 + 32);
+		dir = u64(eocd64 + 48);
+	}
+
+	bool found = false;
+	uint64_t method = 0, csize = 0, local = 0;
+	size_t q = dir;
+	for (uint64_t e = 0; e < entries; ++e) {
+		if (u32(q) != 0x02014b50) throw std::runtime_error("Corrupt npz file");
+		const size_t name_len = u16(q + 28), extra_len = u16(q + 30), comment_len = u16(q + 32);
+		if (q + 46 + name_len > n) throw std::runtime_error("Corrupt npz file");
+		const std::string name(reinterpret_cast<const char*>(b) + q + 46, name_len);
+		uint64_t m = u16(q + 10), cs = u32(q + 20), us = u32(q + 24), off = u32(q + 42);
+		// zip64 extended information: the fields at their maximum follow in this order
+		for (size_t x = q + 46 + name_len; x + 4 <= q + 46 + name_len + extra_len; x += 4 + u16(x + 2)) {
+			if (u16(x) != 0x0001) continue;
+			size_t y = x + 4;
+			if (us == 0xffffffff) { us = u64(y); y += 8; }
+			if (cs == 0xffffffff) { cs = u64(y); y += 8; }
+			if (off == 0xffffffff) { off = u64(y); }
+		}
+		const bool is_npy = name.size() >= 4 && name.compare(name.size() - 4, 4, ".npy") == 0;
+		if (is_npy && (!found || name == "arr_0.npy")) {
+			found = true;
+			method = m; csize = cs; local = off;
+			if (name == "arr_0.npy") break;
+		}
+		q += 46 + name_len + extra_len + comment_len;
+	}
+	if (!found) throw std::runtime_error("No array in the npz file");
+	if (u32(local) != 0x04034b50) throw std::runtime_error("Corrupt npz file");
+	const size_t start = local + 30 + u16(local + 26) + u16(local + 28);
+	if (start + csize > n) throw std::runtime_error("Corrupt npz file");
+	if (method == 0) {
+		enc = ByteReader::STORED;
+	} else if (method == 8) {
+		enc = ByteReader::DEFLATE;
+	} else {
+		throw std::runtime_error("Unsupported compression method in the npz file");
+	}
+	data = file.data() + start;
+	size = csize;
+}
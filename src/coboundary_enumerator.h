@@ -13,16 +13,33 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 class CoboundaryEnumerator
 {
-private:
-	uint8_t position;
-    uint8_t dim;
-	DenseCubicalGrids* dcg;
 public:
-	Cube cube;
-	Cube nextCoface;
+	static constexpr uint8_t MAX_COFACES = 8;  // a 0-cell in 4D has 8 cofaces
+	static constexpr uint8_t MAX_VOXELS = 16;  // voxels defining the birth of a single coface
+	static constexpr uint8_t MAX_GATHER = 32;  // voxels defining the births of all the cofaces of a cell
 
 	CoboundaryEnumerator(DenseCubicalGrids* _dcg, uint8_t dim);
-	void setCoboundaryEnumerator(Cube& _s);
 
-	bool hasNextCoface();
+	// write the cofaces of c with birth other than the threshold to out (in descending order of index)
+	// and return their number
+	uint8_t fill(const Cube& c, Cube* out) const;
+
+private:
+	// cofaces of a cell of a given type m, relative to the cell
+	struct CofaceTable {
+		uint8_t first = 0;     // cofaces before this one are skipped (out-of-plane cofaces of a 2D T-construction)
+		uint8_t count = 0;
+		uint8_t nvoxels = 0;   // voxels per coface
+		uint8_t ngather = 0;
+		int64_t gather[MAX_GATHER];              // offsets of the voxels in the padded grid
+		uint8_t voxels[MAX_COFACES][MAX_VOXELS]; // positions in gather of the voxels of each coface
+		int64_t delta[MAX_COFACES];              // difference of the linear index
+		uint8_t m[MAX_COFACES];                  // type of the coface
+	};
+	DenseCubicalGrids* dcg;
+	uint8_t dim;
+	bool tconstruction; // birth of a coface is the min (T) or max (V) of its voxels
+	std::vector<CofaceTable> tables; // indexed by the type of the cell
+
+	void addCoface(CofaceTable& t, int dx, int dy, int dz, int dw, uint8_t m);
 };
@@ -16,9 +16,9 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <algorithm>
 #include <queue>
 #include <vector>
-#include <unordered_map>
 #include <string>
 #include <cstdint>
+#include <memory>
 #include <time.h>
 
 using namespace std;
@@ -27,38 +27,74 @@ using namespace std;
 #include "dense_cubical_grids.h"
 #include "coboundary_enumerator.h"
 #include "write_pairs.h"
+#include "pair_writer.h"
 #include "compute_pairs.h"
+#include "cube_sort.h"
 
 
-ComputePairs::ComputePairs(DenseCubicalGrids* _dcg, std::vector<WritePairs> &_wp, Config& _config)
-    : dcg(_dcg), wp(&_wp), config(&_config), dim(1) { // Initialize dim to 1 (default method is LINK_FIND, where we skip dim=0)
+ComputePairs::ComputePairs(DenseCubicalGrids* _dcg, std::vector<WritePairs> &_wp, const Config& _config, PairWriter* _writer)
+    : dcg(_dcg), wp(&_wp), writer(_writer), config(&_config), dim(1) { // Initialize dim to 1 (default method is LINK_FIND, where we skip dim=0)
 
 #ifdef GOOGLE_HASH
-    pivot_column_index.set_empty_key(0xffffffff); // for Google hash
+    pivot_column_index.set_empty_key(NONE); // for Google hash
 #endif
 }
 
+ComputePairs::~ComputePairs() = default;
+
+void ComputePairs::reset(PairWriter* _writer){
+	writer = _writer;
+	dim = 1;
+	const CubeLayout &l = dcg->layout;
+	const CubeLayout &e = enumerators_layout;
+	if (l.sx != e.sx || l.sy != e.sy || l.sz != e.sz || l.origin != e.origin || dcg->dim != enumerators_grid_dim) {
+		enumerators.clear();
+	}
+}
+
+
+// As many columns are cached as the budget holds. Columns that needed no reduction are never cached
+// (their cofaces are enumerated again quickly), and when the cache holds fewer columns than there are,
+// it is kept for those that needed more reductions: one more for each halving of the share cached.
+void ComputePairs::auto_cache_settings(uint64_t n, uint64_t memory_budget, uint32_t& cache_size, int& min_recursion){
+	// a cached column: a few times the cofaces of a cell, and the node of the hash map
+	constexpr uint64_t column_bytes = 4 * CoboundaryEnumerator::MAX_COFACES * sizeof(Cube) + 64;
+	const uint64_t capacity = std::max<uint64_t>(1, memory_budget / column_bytes);
+	cache_size = static_cast<uint32_t>(std::min<uint64_t>({capacity, std::max<uint64_t>(n, 1), UINT32_MAX}));
+	min_recursion = 1;
+	for (uint64_t share = capacity; share < n && min_recursion < 32; share *= 2) ++min_recursion;
+}
 
 void ComputePairs::compute_pairs_main(vector<Cube>& ctr){
-	vector<Cube> coface_entries; // pivotIDs of cofaces
+	Cube coface_entries[CoboundaryEnumerator::MAX_COFACES]; // pivotIDs of cofaces
 	auto ctl_size = ctr.size();
+	uint32_t cache_size = config->cache_size;
+	int min_recursion_to_cache = config->min_recursion_to_cache;
+	if(config->auto_cache){
+		auto_cache_settings(ctl_size, config->memory_budget, cache_size, min_recursion_to_cache);
+	}
 	if(config->verbose){
 	    cout << "# columns to reduce: " << ctl_size << endl;
+		if(config->auto_cache){
+			cout << "# cache size: " << cache_size << ", min recursion to cache: " << min_recursion_to_cache << endl;
+		}
 	}
 	pivot_column_index.clear();
 #ifdef GOOGLE_HASH
 	pivot_column_index.resize(ctl_size); // googlehash
-#else
-    pivot_column_index.reserve(ctl_size);
 #endif
-	CoboundaryEnumerator cofaces(dcg,dim);
-	unordered_map<uint32_t, CubeQue > recorded_wc;
-	queue<uint32_t> cached_column_idx;
-	recorded_wc.reserve(ctl_size);
+	if(enumerators.empty()){
+		enumerators_layout = dcg->layout;
+		enumerators_grid_dim = dcg->dim;
+	}
+	if(enumerators.size() <= dim) enumerators.resize(static_cast<size_t>(dim) + 1);
+	if(!enumerators[dim]) enumerators[dim] = make_unique<CoboundaryEnumerator>(dcg, dim);
+	const CoboundaryEnumerator &cofaces = *enumerators[dim];
+	recorded_wc.clear();
     int num_apparent_pairs = 0;
 
-	for(uint32_t i = 0; i < ctl_size; ++i){  // descending order of birth
-        CubeQue working_coboundary;   // non-zero entries of the column
+	for(uint64_t i = 0; i < ctl_size; ++i){  // descending order of birth
+        working_coboundary.clear();   // non-zero entries of the column
 		double birth = ctr[i].birth;
 //        cout << i << endl;  ctr[i].print();   // debug
 
@@ -71,34 +107,27 @@ void ComputePairs::compute_pairs_main(vector<Cube>& ctr){
 		for(int k = 0; k < config->maxiter; ++k) { // for each column{}
             bool cache_hit = false;
             if(i!=j){
-                auto findWc = recorded_wc.find(j);
-                if(findWc != recorded_wc.end()){ // If the reduced form of the pivot column is cached
+                size_t cached_size;
+                const Cube* cached = recorded_wc.find(j, cached_size);
+                if(cached != nullptr){ // If the reduced form of the pivot column is cached
                     cache_hit = true;
-                    auto wc = findWc -> second;
-                    while(!wc.empty()){ // add the cached pivot column
-                        working_coboundary.push(wc.top());
-                        wc.pop();
+                    for(size_t c = 0; c < cached_size; ++c){ // add the cached pivot column
+                        working_coboundary.push(cached[c]);
                     }
                 }
 //				assert(might_be_apparent_pair == false); // As there is always cell-coface pair with the same birthtime, the flag should be set by the next block.
 			}
             if(!cache_hit){
                 // make the column by enumerating cofaces
-                coface_entries.clear();
-                cofaces.setCoboundaryEnumerator(ctr[j]);
-                while (cofaces.hasNextCoface()) {
-                    coface_entries.push_back(cofaces.nextCoface);
-                    // cout << "coface: " << j << endl;
-                    // ctr[j].print();
-                    // cofaces.nextCoface.print();
-                    if (might_be_apparent_pair && (ctr[j].birth == cofaces.nextCoface.birth)) { // we cannot find this coface on the left (Short-Circuit Evaluation)
-                        if (pivot_column_index.find(cofaces.nextCoface.index) == pivot_column_index.end()) { // If coface is not in pivot list
-                            pivot.copyCube(cofaces.nextCoface);
+                const uint8_t num_cofaces = cofaces.fill(ctr[j], coface_entries);
+                for (uint8_t f = 0; f < num_cofaces && might_be_apparent_pair; ++f) {
+                    const Cube &e = coface_entries[f];
+                    if (ctr[j].birth == e.birth) { // we cannot find this coface on the left
+                        if (pivot_column_index.find(e.index) == pivot_column_index.end()) { // If coface is not in pivot list
+                            pivot.copyCube(e);
                             found_persistence_pair = true;
-                            				break;
-                        } else {
-                            might_be_apparent_pair = false;
                         }
+                        might_be_apparent_pair = false;
                     }
                 }
                 if (found_persistence_pair) {
@@ -107,8 +136,8 @@ void ComputePairs::compute_pairs_main(vector<Cube>& ctr){
                     num_apparent_pairs++;
                     break;
                 }
-                for(const auto e : coface_entries){
-                    working_coboundary.push(e);
+                for (uint8_t f = 0; f < num_cofaces; ++f) {
+                    working_coboundary.push(coface_entries[f]);
                 }
             }
             pivot = get_pivot(working_coboundary);
@@ -120,26 +149,23 @@ void ComputePairs::compute_pairs_main(vector<Cube>& ctr){
 //                        cout << i << " to " << j << " " << pivot.index << endl;
                     continue;
                 } else { // If the pivot is new
-                    if(num_recurse >= config->min_recursion_to_cache){
-                        add_cache(i, working_coboundary, recorded_wc);
-						cached_column_idx.push(i);
-						if(cached_column_idx.size()>config->cache_size){
-							recorded_wc.erase(cached_column_idx.front());
-							cached_column_idx.pop();
-						}
+                    if(num_recurse >= min_recursion_to_cache){
+                        recorded_wc.add(i, working_coboundary, cache_size);
                     }
                     // pivot_column_index.emplace(pivot.index, i); // column i has the pivot
 					pivot_column_index[pivot.index] = i;
                     double death = pivot.birth;
                     if (birth != death) {
-						wp->emplace_back(WritePairs(dim, ctr[i], pivot, dcg, config->print));
+						wp->emplace_back(dim, ctr[i], dim, pivot, static_cast<uint8_t>(dim + 1));
+						if (writer) writer->writeIfFull(*wp);
                     }
 //                        cout << pivot.index << ",f," << i << endl;
                     break;
                 }
             } else { // the column is reduced to zero, which means it corresponds to a permanent cycle
                 if (birth != dcg->threshold) {
-					wp->emplace_back(WritePairs(dim, birth, dcg->threshold, ctr[i].x(), ctr[i].y(), ctr[i].z(), ctr[i].w(), 0, 0, 0, 0, config->print));
+					wp->emplace_back(dim, ctr[i], dim);
+					if (writer) writer->writeIfFull(*wp);
                 }
                 break;
             }
@@ -150,19 +176,60 @@ void ComputePairs::compute_pairs_main(vector<Cube>& ctr){
     }
 }
 
+void ColumnCache::clear(){
+	cells.clear();
+	spans.clear();
+	head = 0;
+	live = 0;
+	where.clear();
+}
+
+const Cube* ColumnCache::find(uint64_t j, size_t& n) const{
+	const auto it = where.find(j);
+	if(it == where.end()) return nullptr;
+	const Span &s = spans[it->second];
+	n = s.length;
+	return cells.data() + s.offset;
+}
+
 // cache a new reduced column after mod 2
-void ComputePairs::add_cache(uint32_t i, CubeQue &wc, unordered_map<uint32_t, CubeQue>& recorded_wc){
-	CubeQue clean_wc;
+void ColumnCache::add(uint64_t j, CubeQue& wc, uint64_t capacity){
+	if(capacity == 0) return;
+	const size_t offset = cells.size();
 	while(!wc.empty()){
 		auto c = wc.top();
 		wc.pop();
 		if(!wc.empty() && c.index==wc.top().index){
 			wc.pop();
 		}else{
-			clean_wc.push(c);
+			cells.push_back(c);
 		}
 	}
-	recorded_wc.emplace(i,clean_wc);
+	where[j] = spans.size();
+	spans.push_back(Span{j, offset, cells.size() - offset});
+	live += cells.size() - offset;
+	if(spans.size() - head > capacity){
+		where.erase(spans[head].column);
+		live -= spans[head].length;
+		++head;
+		if(cells.size() > 2 * live + 1024) compact();
+	}
+}
+
+// move the columns held to the front of the arrays
+void ColumnCache::compact(){
+	size_t out = 0;
+	for(size_t k = head; k < spans.size(); ++k){
+		Span s = spans[k];
+		std::copy(cells.data() + s.offset, cells.data() + s.offset + s.length, cells.data() + out);
+		s.offset = out;
+		out += s.length;
+		spans[k - head] = s;
+		where[s.column] = k - head;
+	}
+	spans.resize(spans.size() - head);
+	cells.resize(out);
+	head = 0;
 }
 
 // get the pivot from a column after mod 2
@@ -198,7 +265,6 @@ Cube ComputePairs::get_pivot(CubeQue& column) {
 void ComputePairs::assemble_columns_to_reduce(vector<Cube>& ctr, uint8_t _dim) {
 	dim = _dim;
 	ctr.clear();
-	double birth;
     uint8_t max_m = 0;
     // Determine number of mask types per target dimension based on ambient dimension
     // 3D: dim 0/1/2/3 => 1/3/3/1
@@ -221,7 +287,7 @@ void ComputePairs::assemble_columns_to_reduce(vector<Cube>& ctr, uint8_t _dim) {
     }
     // Special-case: 2D image under T-construction (embedded in 3D with az==1)
     // Restrict mask variants to in-plane components
-    if (dcg->config->tconstruction && dcg->az == 1 && dcg->dim < 4) {
+    if (dcg->tconstruction && dcg->az == 1 && dcg->dim < 4) {
         switch (dim) {
             case 0: max_m = 1; break;      // 0-cells: single variant
             case 1: max_m = 2; break;      // 1-cells: only x- and y-edges (no z)
@@ -231,27 +297,18 @@ void ComputePairs::assemble_columns_to_reduce(vector<Cube>& ctr, uint8_t _dim) {
     if (dim == 0) {
         pivot_column_index.clear();
     }
-    for (uint8_t m = 0; m < max_m; ++m) {
-        for(uint32_t w = 0; w < dcg->aw; ++w){
-            for(uint32_t z = 0; z < dcg->az; ++z){
-                for (uint32_t y = 0; y < dcg->ay; ++y) {
-                    for (uint32_t x = 0; x < dcg->ax; ++x) {
-                        birth = dcg -> getBirth(x,y,z,w,m, dim);
-//                        cout << x << "," << y << "," << z << ", " << m << "," << birth << endl;
-                        Cube v(birth,x,y,z,w,m);
-                        if (birth < dcg -> threshold && pivot_column_index.find(v.index) == pivot_column_index.end()) {
-                            ctr.push_back(v);
-                        }
-                    }
+    vector<uint8_t> types(max_m);
+    for (uint8_t m = 0; m < max_m; ++m) types[m] = m;
+    // the pivot map is only read here, so the rows can be scanned concurrently
+    dcg->collectCells(types, resolve_threads(config->num_threads), ctr,
+        [this](uint8_t m, uint32_t y, uint32_t z, uint32_t w, vector<Cube>& out) {
+            for (uint32_t x = 0; x < dcg->ax; ++x) {
+                double birth = dcg -> getBirth(x,y,z,w,m, dim);
+                Cube v(birth, dcg->layout.index(x,y,z,w,m));
+                if (birth < dcg -> threshold && pivot_column_index.find(v.index) == pivot_column_index.end()) {
+                    out.push_back(v);
                 }
             }
-        }
-    }
-    clock_t start = clock();
-    sort(ctr.begin(), ctr.end(), CubeComparator());
-	if(config->verbose){
-		clock_t end = clock();
-		const double time = static_cast<double>(end - start) / CLOCKS_PER_SEC * 1000.0;
-		cout << "Sorting took: " <<  time << endl;
-	}
+        });
+    sort_cubes(ctr, dcg, config, sort_space);
 }
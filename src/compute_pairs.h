@@ -12,9 +12,12 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #pragma once
+#include <memory>
+#include <queue>
 #include <vector>
-#include <unordered_map>
 #include "config.h"
+#include "index_map.h"
+#include "cube_sort.h"
 
 // #define GOOGLE_HASH
 
@@ -24,25 +27,74 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
-typedef priority_queue<Cube, vector<Cube>, CubeComparator> CubeQue;
+class PairWriter;
+class CoboundaryEnumerator;
+
+// a column under reduction; clear() keeps the storage for the next column
+class CubeQue : public priority_queue<Cube, vector<Cube>, CubeComparator> {
+public:
+	void clear() { c.clear(); }
+	const vector<Cube>& entries() const { return c; } // in heap order
+};
+
+// Reduced columns cached for the columns to reduce after them, in a single array of cells
+// (in place of a heap for each column). At most a given number of columns are held;
+// the oldest one is dropped for a new one, and the array is compacted once most of it is dropped.
+class ColumnCache {
+public:
+	// forget all the columns (keeping the storage)
+	void clear();
+	// the cells of the column cached for column j (in the order they are popped from a CubeQue),
+	// or null if there is none; n is set to their number
+	const Cube* find(uint64_t j, size_t& n) const;
+	// cache column j, reduced mod 2 from wc (which is emptied), keeping at most capacity columns
+	void add(uint64_t j, CubeQue& wc, uint64_t capacity);
+
+private:
+	struct Span {
+		uint64_t column;
+		size_t offset; // in cells
+		size_t length;
+	};
+	vector<Cube> cells;
+	vector<Span> spans; // in the order they were cached; those before head are dropped
+	size_t head{0};
+	size_t live{0}; // cells of the columns held
+	IndexMap where; // column -> position in spans
+
+	void compact();
+};
 
 class ComputePairs{
 private:
 	DenseCubicalGrids* dcg;
 #ifdef GOOGLE_HASH
-    google::dense_hash_map<uint64_t, uint32_t> pivot_column_index;
+    google::dense_hash_map<uint64_t, uint64_t> pivot_column_index;
 #else
-    unordered_map<uint64_t, uint32_t> pivot_column_index;
+    IndexMap pivot_column_index;
 #endif
 	uint8_t dim;
 	vector<WritePairs> *wp;
-	Config* config;
+	PairWriter* writer; // the pairs are flushed to it as they accumulate (if not null)
+	const Config* config;
+	// kept from a dimension (and a grid) for the next
+	ColumnCache recorded_wc; // cached reduced columns
+	CubeQue working_coboundary;
+	CubeSortSpace sort_space;
+	vector<unique_ptr<CoboundaryEnumerator>> enumerators; // by dimension, built when first needed
+	CubeLayout enumerators_layout; // and the dimension of the grid they were built for
+	uint8_t enumerators_grid_dim{0};
 
 public:
-	ComputePairs(DenseCubicalGrids* _dcg, vector<WritePairs> &_wp, Config&);
+	ComputePairs(DenseCubicalGrids* _dcg, vector<WritePairs> &_wp, const Config&, PairWriter* _writer = nullptr);
+	~ComputePairs();
+	// start over with the next grid (filled into the same DenseCubicalGrids), writing to _writer;
+	// the pivot table and the cache keep their storage, and so do the coboundary tables if the grid has the same shape
+	void reset(PairWriter* _writer);
 	void compute_pairs_main(vector<Cube>& ctr);
+	// cache settings for n columns to reduce within the memory budget (Config::auto_cache)
+	static void auto_cache_settings(uint64_t n, uint64_t memory_budget, uint32_t& cache_size, int& min_recursion);
 	void assemble_columns_to_reduce(vector<Cube>& ctr, uint8_t _dim);
-	void add_cache(uint32_t i, CubeQue &wc, unordered_map<uint32_t, CubeQue>& recorded_wc);
 	Cube pop_pivot(vector<Cube>& column);
 	Cube get_pivot(vector<Cube>& column);
 	Cube pop_pivot(CubeQue& column);
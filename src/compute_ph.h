@@ -0,0 +1,220 @@
+/* compute_ph.h
+
+The computation of the persistence pairs of an image held in memory, shared by the Python binding
+and the benchmarks: the pipeline of each method, the working space kept from an image for the next,
+and PHEngine, which keeps all of it for images of a fixed shape.
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "cube.h"
+#include "config.h"
+#include "write_pairs.h"
+#include "dense_cubical_grids.h"
+#include "joint_pairs.h"
+#include "compute_pairs.h"
+#include "pair_writer.h"
+
+using namespace std;
+
+// compute the persistence pairs of the grid with jp and cp (made for dcg and writepairs),
+// which keep their working space for the next grid; ctr is working space, too.
+// The pairs are flushed to writer (if given) as they accumulate, and when each dimension is done.
+inline void computePairs(DenseCubicalGrids* dcg, const Config& config, vector<WritePairs>& writepairs, JointPairs& jp, ComputePairs& cp,
+		vector<Cube>& ctr, PairWriter* writer){
+	auto flush = [&](){ if(writer) writer->write(writepairs); };
+	if(config.method==ALEXANDER){
+		if(dcg->tconstruction){
+			throw std::invalid_argument("Alexander duality (top_dim) for T-construction not implemented");
+		}
+		if(dcg->dim==1){
+			jp.enum_edges({0},ctr);
+			jp.joint_pairs_main(ctr,0); // dim0
+		}else if(dcg->dim==2){
+			jp.enum_edges({0,1,3,4},ctr);
+			jp.joint_pairs_main(ctr,1); // dim1
+		}else if(dcg->dim==3){
+			jp.enum_edges({0,1,2,3,4,5,6,7,8,9,10,11,12},ctr);
+			jp.joint_pairs_main(ctr,2); // dim2
+		}
+		flush();
+	}else if(config.method==COMPUTEPAIRS){
+		for(uint8_t d = 0; d <= config.maxdim && d <= 3; ++d){
+			cp.assemble_columns_to_reduce(ctr,d);
+			cp.compute_pairs_main(ctr); // dim d
+			flush();
+		}
+	}else{
+		if(dcg->dim==1){
+			jp.enum_edges({0},ctr);
+		}else if(dcg->dim==2){
+			jp.enum_edges({0,1},ctr);
+		}else if(dcg->dim==3){
+			jp.enum_edges({0,1,2},ctr);
+		}else if(dcg->dim==4){
+			jp.enum_edges({0,1,2,3},ctr);
+		}
+		jp.joint_pairs_main(ctr,0); // dim0
+		flush();
+		if(config.maxdim>0){
+			cp.compute_pairs_main(ctr); // dim1
+			flush();
+			for(uint8_t d = 2; d <= config.maxdim && d <= 3; ++d){
+				cp.assemble_columns_to_reduce(ctr,d);
+				cp.compute_pairs_main(ctr); // dim d
+				flush();
+			}
+		}
+	}
+}
+
+// compute the persistence pairs of the grid;
+// ctr is working space, which may be kept for the next grid.
+inline void computePairs(DenseCubicalGrids* dcg, const Config& config, vector<WritePairs>& writepairs, vector<Cube>& ctr, PairWriter* writer=nullptr){
+	JointPairs jp(dcg, writepairs, config, writer);
+	ComputePairs cp(dcg, writepairs, config, writer);
+	computePairs(dcg, config, writepairs, jp, cp, ctr, writer);
+}
+
+// the number of columns of the rows of an image of dimension ndim
+inline size_t numColumns(uint8_t ndim, output_location location){
+	if(location == LOC_NONE) return 3;
+	return (ndim > 3) ? 11 : 9;
+}
+
+// compute the pairs of the grid and append them as rows (dim, birth, death[, creator, destroyer]) to rows;
+// they are resolved into rows in chunks while they are computed, so that only a chunk of them is held at a time.
+// on_rows (if given) is called with each range of rows as it is appended: at the end of each dimension,
+// and every PairWriter::CHUNK pairs in between.
+inline void computeRows(DenseCubicalGrids* dcg, const Config& config, vector<WritePairs>& writepairs, vector<Cube>& ctr, RowBuffer& rows,
+		std::function<void(size_t first, size_t n)> on_rows=nullptr){
+	PairWriter writer(dcg, config, &rows, std::move(on_rows));
+	computePairs(dcg, config, writepairs, ctr, &writer);
+	writer.write(writepairs);
+}
+
+// Images of at most this many voxels (e.g. 128x128) are computed on a single thread,
+// as starting the threads would take about as long as the whole computation.
+constexpr uint64_t SMALL_IMAGE_VOXELS = 1 << 14;
+
+// the number of threads (0: all hardware threads) to compute an image of the given number of voxels with
+inline int imageThreads(uint64_t voxels, int threads){
+	return (voxels <= SMALL_IMAGE_VOXELS) ? 1 : threads;
+}
+
+// The grid and all the working space of the computation (the cells, the union-find, the pivot table
+// and the cache of the reduction, the coboundary tables, the pairs resolved into rows), kept from an image
+// for the next: once it has grown to the size of the images, computing one allocates nothing but the rows
+// (allocating it all anew takes about as long as computing the pairs of a small image).
+// The grid and the coboundary tables are reused as they are when the next image has the same shape.
+// Its parts point to each other, so it is neither copied nor moved.
+class PHWorkspace {
+public:
+	PHWorkspace() = default;
+	PHWorkspace(const PHWorkspace&) = delete;
+	PHWorkspace& operator=(const PHWorkspace&) = delete;
+
+	// the grid, emptied for an image of the given shape to be computed under _config
+	DenseCubicalGrids* grid(const Config& _config, uint8_t d, uint32_t x, uint32_t y = 1, uint32_t z = 1, uint32_t w = 1){
+		config = _config;
+		if (!dcg) {
+			dcg = std::make_unique<DenseCubicalGrids>(config, d, x, y, z, w);
+		}
+		dcg->config = &config;
+		dcg->reset(d, x, y, z, w);
+		writepairs.clear();
+		return dcg.get();
+	}
+
+	// computeRows of the grid filled (and finalisePadding'ed) since grid()
+	void computeRows(RowBuffer& rows, std::function<void(size_t first, size_t n)> on_rows = nullptr){
+		if (!jp) {
+			jp = std::make_unique<JointPairs>(dcg.get(), writepairs, config);
+			cp = std::make_unique<ComputePairs>(dcg.get(), writepairs, config);
+		}
+		if (writer) {
+			writer->setRows(&rows, std::move(on_rows));
+		} else {
+			writer = std::make_unique<PairWriter>(dcg.get(), config, &rows, std::move(on_rows));
+		}
+		jp->reset(writer.get());
+		cp->reset(writer.get());
+		computePairs(dcg.get(), config, writepairs, *jp, *cp, ctr, writer.get());
+		writer->write(writepairs);
+	}
+
+private:
+	Config config;
+	std::unique_ptr<DenseCubicalGrids> dcg;
+	vector<WritePairs> writepairs;
+	vector<Cube> ctr;
+	std::unique_ptr<JointPairs> jp;
+	std::unique_ptr<ComputePairs> cp;
+	std::unique_ptr<PairWriter> writer;
+};
+
+// The computation of image after image of a fixed shape (e.g. the volumes of a time series) under fixed settings,
+// with all that the computation allocates kept from an image for the next: the grid, the cells to reduce,
+// the union-find, the pivot table and the cache of the reduction, the coboundary tables and the pairs resolved
+// into rows. An engine is used by a thread at a time (one engine for each thread).
+class PHEngine {
+public:
+	// images of extents (x,y,z,w) in dimension d, read as gridFromArray with embedded
+	PHEngine(const Config& _config, bool _embedded, uint8_t d, uint32_t x, uint32_t y = 1, uint32_t z = 1, uint32_t w = 1)
+		: config(_config), embedded(_embedded), dim(d), shape{x, y, z, w} {}
+	PHEngine(const PHEngine&) = delete;
+	PHEngine& operator=(const PHEngine&) = delete;
+
+	const Config& settings() const { return config; }
+	uint8_t dimension() const { return dim; }
+	const uint32_t* extents() const { return shape; }
+	size_t numColumns() const { return ::numColumns(dim, config.location); }
+
+	// append the rows of the pairs of the image arr to rows, as computeRows;
+	// the element (x,y,z,w) of the image is arr[x*strides[0] + y*strides[1] + z*strides[2] + w*strides[3]].
+	// rows gets room for as many rows as the previous image had.
+	template <typename T>
+	void compute(const T* arr, const array<int64_t, 4>& strides, RowBuffer& rows,
+			std::function<void(size_t first, size_t n)> on_rows = nullptr){
+		DenseCubicalGrids* dcg = ws.grid(config, dim, shape[0], shape[1], shape[2], shape[3]);
+		dcg->gridFromArray(arr, embedded, strides, nullptr, false);
+		dcg->finalisePadding();
+		const size_t first = rows.rows();
+		rows.reserve(first + last_rows);
+		ws.computeRows(rows, std::move(on_rows));
+		last_rows = rows.rows() - first;
+	}
+
+	// the same for a contiguous array (in C or Fortran order)
+	template <typename T>
+	void compute(const T* arr, bool fortran_order, RowBuffer& rows, std::function<void(size_t first, size_t n)> on_rows = nullptr){
+		compute(arr, DenseCubicalGrids::contiguousStrides(fortran_order, shape[0], shape[1], shape[2], shape[3]),
+			rows, std::move(on_rows));
+	}
+
+private:
+	Config config;
+	bool embedded;
+	uint8_t dim;
+	uint32_t shape[4];
+	PHWorkspace ws;
+	size_t last_rows{0};
+};
@@ -7,24 +7,37 @@
 
 enum calculation_method { LINKFIND, COMPUTEPAIRS, ALEXANDER};
 enum output_location { LOC_NONE, LOC_YES};
-enum file_format { DIPHA, PERSEUS, NUMPY, CSV };
+enum file_format { DIPHA, PERSEUS, NUMPY, CSV, NPZ }; // NUMPY and DIPHA may be gzip-compressed (.gz)
+// layout of the .npy output: float64 matrix, or records (uint8 dim, float64 or float32 birth/death, int16 or int32 coordinates)
+enum npy_layout { NPY_MATRIX, NPY_STRUCTURED, NPY_STRUCTURED32 };
 
 
 struct Config {
 	std::string filename = "";
 	std::string output_filename = "output.csv"; //default output filename
-	file_format format;
+	file_format format = NUMPY;
+	std::string mask_filename = ""; // voxels where the mask is zero are left out of the complex
+	file_format mask_format = NUMPY;
 	calculation_method method = LINKFIND;
 	double threshold = DBL_MAX;
 	int maxdim=3;  // compute PH up to this dimension
 	bool print = false; // flag for printing persistence pairs to stdout
 	bool verbose = false;
-	bool tconstruction = false; // T-construction or V-construction
 	bool embedded = false; // embed image in the sphere (for alexander duality)
 	output_location location = LOC_YES; // flag for saving location
+	npy_layout npy = NPY_MATRIX;
 	int min_recursion_to_cache = 0; // num of minimum recursions for a reduced column to be cached
 	uint32_t cache_size = 1 << 31; // the maximum number of reduced columns to be cached
+	bool auto_cache = false; // choose cache_size and min_recursion_to_cache for each dimension from the number of columns and memory_budget
+	uint64_t memory_budget = uint64_t(1) << 30; // bytes for the cached columns (auto_cache)
 	int maxiter = 1000000; // maximum number of iterations for each column (for debug)
+	int num_threads = 0; // worker threads for parsing text inputs, enumerating and sorting cells and writing pairs (0: all hardware threads)
+	uint32_t bucket_levels = 256; // images with at most this many distinct values are rank-transformed and sorted by buckets (0 to disable)
+#ifdef COMPACT_CUBE
+	bool rank = true; // 8-byte cells carry ranks, so filtration values are always rank-transformed
+#else
+	bool rank = false; // rank-transform filtration values at load (only their order matters)
+#endif
 };
 
 #endif
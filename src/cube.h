@@ -14,13 +14,33 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 #include <cstdint>
 #include <iostream>
+#include <stdexcept>
 
-constexpr uint64_t NONE = 0xffffffffffffffff;
+// Define COMPACT_CUBE for 8-byte cells: the birth is then the 32-bit rank of the
+// filtration value (Config::rank is always on) and the index is 32-bit.
+// #define COMPACT_CUBE
+
+#ifdef COMPACT_CUBE
+typedef uint32_t birth_t;
+typedef uint32_t index_t;
+#else
+typedef double birth_t;
+typedef uint64_t index_t;
+#endif
+
+constexpr index_t NONE = static_cast<index_t>(~static_cast<index_t>(0));
+
+// Cube::index keeps the type m of the cell in the top 4 bits and the linear index
+// of the anchor voxel of the cell in the padded grid (x fastest) in the lower bits.
+// The strides are chosen per run from the actual extents (see CubeLayout),
+// so there is no limit on each axis and the index can be used directly as a key.
+constexpr int CUBE_TYPE_SHIFT = 8 * sizeof(index_t) - 4;
+constexpr uint64_t CUBE_VOXEL_MASK = (static_cast<uint64_t>(1) << CUBE_TYPE_SHIFT) - 1;
 
 class Cube {
 public:
-    double birth{0};
-    uint64_t index{NONE};
+    birth_t birth{0};
+    index_t index{NONE};
 
     // Default constructor
     Cube() = default;
@@ -28,25 +48,13 @@ public:
     // Copy constructor
     Cube(const Cube& other) = default;
 
-    // Constructor with detailed initialization
-    Cube(double _birth, uint32_t _x, uint32_t _y, uint32_t _z, uint32_t _w, uint8_t _m)
-        : birth(_birth),
-          index(static_cast<uint64_t>(_x)
-                | (static_cast<uint64_t>(_y) << 15)
-                | (static_cast<uint64_t>(_z) << 30)
-                | (static_cast<uint64_t>(_w) << 45)
-                | (static_cast<uint64_t>(_m) << 60)) {}
-
     // Constructor with index
     Cube(double _birth, uint64_t _index)
-        : birth(_birth), index(_index) {}
+        : birth(static_cast<birth_t>(_birth)), index(static_cast<index_t>(_index)) {}
 
     // Accessor methods
-    uint32_t x() const { return index & 0x7fff; }
-    uint32_t y() const { return (index >> 15) & 0x7fff; }
-    uint32_t z() const { return (index >> 30) & 0x7fff; }
-    uint32_t w() const { return (index >> 45) & 0x7fff; }
-    uint8_t m() const { return (index >> 60) & 0xf; }
+    uint8_t m() const { return static_cast<uint8_t>(index >> CUBE_TYPE_SHIFT); }
+    uint64_t voxel() const { return index & CUBE_VOXEL_MASK; }
 
     // Copy method
     void copyCube(const Cube& other) {
@@ -56,8 +64,8 @@ public:
 
     // Print method
     void print() const {
-        std::cout << "Cube(birth: " << birth << ", x: " << x() << ", y: " << y()
-                  << ", z: " << z() << ", w: " << w() << ", m: " << static_cast<int>(m()) << ")\n";
+        std::cout << "Cube(birth: " << birth << ", voxel: " << voxel()
+                  << ", m: " << static_cast<int>(m()) << ")\n";
     }
 
     // Equality operator
@@ -66,6 +74,58 @@ public:
     }
 };
 
+// Axes spanned by a cell of dimension d and type m (x=1, y=2, z=4, w=8),
+// following the m-encoding of DenseCubicalGrids::getBirth()
+inline uint8_t cellSpan(uint8_t d, uint8_t m, bool is4d) {
+    static const uint8_t span3[4][3] = {{0}, {1, 2, 4}, {3, 5, 6}, {7}};
+    static const uint8_t span4[5][6] = {{0}, {1, 2, 4, 8}, {3, 5, 6, 9, 10, 12}, {7, 11, 13, 14}, {15}};
+    return is4d ? span4[d][m] : span3[d][m];
+}
+
+// Conversion between cell coordinates (x,y,z,w,m) and Cube::index.
+// The coordinates are shifted by one to skip the boundary of the padded grid,
+// so that a cell may sit at -1 in any axis (such cells are always at threshold).
+// All products are 64-bit.
+class CubeLayout {
+public:
+    uint64_t sx{1}, sy{1}, sz{1};   // extents of the padded grid
+    uint64_t sxy{1}, sxyz{1};       // strides along z and w
+    uint64_t origin{0};             // linear index of the voxel at (0,0,0,0)
+
+    // px,py,pz: extents of the padded grid; has_w: whether the grid is 4D
+    void set(uint64_t px, uint64_t py, uint64_t pz, uint64_t pw, bool has_w) {
+        sx = px; sy = py; sz = pz;
+        sxy = px * py;
+        sxyz = sxy * pz;
+        origin = 1 + sx + sxy + (has_w ? sxyz : 0);
+        if (pw > CUBE_VOXEL_MASK / sxyz) {
+            throw std::runtime_error("The image is too large to be indexed");
+        }
+    }
+
+    // linear offset of the voxel at (x,y,z,w) relative to the origin (wraps for negative coordinates)
+    uint64_t offset(int64_t x, int64_t y, int64_t z, int64_t w) const {
+        return static_cast<uint64_t>(x) + sx * static_cast<uint64_t>(y)
+             + sxy * static_cast<uint64_t>(z) + sxyz * static_cast<uint64_t>(w);
+    }
+
+    uint64_t index(int64_t x, int64_t y, int64_t z, int64_t w, uint8_t m) const {
+        return (static_cast<uint64_t>(m) << CUBE_TYPE_SHIFT) | ((origin + offset(x, y, z, w)) & CUBE_VOXEL_MASK);
+    }
+
+    // inverse of offset(); valid for non-negative coordinates
+    void decodeOffset(uint64_t v, uint32_t& x, uint32_t& y, uint32_t& z, uint32_t& w) const {
+        x = static_cast<uint32_t>(v % sx); v /= sx;
+        y = static_cast<uint32_t>(v % sy); v /= sy;
+        z = static_cast<uint32_t>(v % sz);
+        w = static_cast<uint32_t>(v / sz);
+    }
+
+    void decode(uint64_t idx, uint32_t& x, uint32_t& y, uint32_t& z, uint32_t& w) const {
+        decodeOffset((idx & CUBE_VOXEL_MASK) - origin, x, y, z, w);
+    }
+};
+
 // Comparator for sorting cubes
 // true when b1>b2 (tie break i1<i2)
 struct CubeComparator {
@@ -0,0 +1,170 @@
+/* cube_sort.cpp
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+
+#include "cube.h"
+#include "dense_cubical_grids.h"
+#include "cube_sort.h"
+#include "parallel.h"
+
+using namespace std;
+
+// stable counting sort by descending rank
+static void counting_sort(vector<Cube>& ctr, size_t num_levels, CubeSortSpace& space){
+	auto& pos = space.counts;
+	pos.assign(num_levels + 1, 0);
+	for (const auto& c : ctr) {
+		pos[static_cast<size_t>(c.birth)]++;
+	}
+	// start of each level in the output (the highest level comes first)
+	size_t start = 0;
+	for (size_t r = num_levels; r-- > 0; ) {
+		const size_t cnt = pos[r];
+		pos[r] = start;
+		start += cnt;
+	}
+	auto& sorted = space.cubes;
+	sorted.resize(ctr.size());
+	for (const auto& c : ctr) {
+		sorted[pos[static_cast<size_t>(c.birth)]++] = c;
+	}
+	ctr.swap(sorted);
+}
+
+// below this size std::sort is faster than the passes over the whole array
+static const size_t RADIX_MIN_SIZE = 1 << 16;
+
+static double elapsed_ms(chrono::steady_clock::time_point since){
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
+// unsigned key which is ascending when birth is descending
+static inline uint64_t birth_key(double b){
+	if (b == 0) b = 0; // -0.0 compares equal to 0.0
+	uint64_t u;
+	memcpy(&u, &b, sizeof(u));
+	u = (u >> 63) ? ~u : (u | (uint64_t(1) << 63)); // ascending in b
+	return ~u;
+}
+static inline uint64_t birth_key(uint32_t b){
+	return ~b & 0xFFFFFFFFu;
+}
+
+// LSD radix sort (8-bit digits) into the order of CubeComparator, that is, ascending in (birth_key, index).
+// Each pass is stable, and the threads scatter contiguous chunks into disjoint ranges of each bucket.
+// The index digits are skipped when ctr is already in ascending order of index (as enumerated),
+// and so are the digits on which all the keys agree.
+static void radix_sort(vector<Cube>& ctr, unsigned num_threads, CubeSortSpace& space, ostream* log){
+	using Hist = array<size_t, 256>;
+	const size_t n = ctr.size();
+	auto start = chrono::steady_clock::now();
+
+	vector<uint8_t> unsorted(num_threads, 0);
+	parallel_chunks(n, num_threads, [&](unsigned t, size_t b, size_t e){
+		for (size_t i = max<size_t>(b, 1); i < e; ++i) {
+			if (ctr[i-1].index > ctr[i].index) { unsorted[t] = 1; break; }
+		}
+	});
+	const bool index_sorted = find(unsorted.begin(), unsorted.end(), 1) == unsorted.end();
+
+	const size_t index_digits = index_sorted ? 0 : sizeof(index_t);
+	const size_t num_digits = index_digits + sizeof(birth_t);
+	auto digit = [index_digits](const Cube& c, size_t d) -> uint8_t {
+		if (d < index_digits) return static_cast<uint8_t>(c.index >> (8 * d));
+		return static_cast<uint8_t>(birth_key(c.birth) >> (8 * (d - index_digits)));
+	};
+
+	// histograms of all the digits to find the constant ones
+	vector<vector<Hist>> local(num_threads, vector<Hist>(num_digits));
+	const unsigned nt = parallel_chunks(n, num_threads, [&](unsigned t, size_t b, size_t e){
+		auto& h = local[t];
+		for (auto& a : h) a.fill(0);
+		for (size_t i = b; i < e; ++i) {
+			const uint64_t index = ctr[i].index;
+			const uint64_t key = birth_key(ctr[i].birth);
+			for (size_t d = 0; d < index_digits; ++d) h[d][static_cast<uint8_t>(index >> (8 * d))]++;
+			for (size_t d = index_digits; d < num_digits; ++d) h[d][static_cast<uint8_t>(key >> (8 * (d - index_digits)))]++;
+		}
+	});
+	vector<size_t> passes;
+	for (size_t d = 0; d < num_digits; ++d) {
+		const uint8_t v = digit(ctr[0], d);
+		size_t count = 0;
+		for (unsigned t = 0; t < nt; ++t) count += local[t][d][v];
+		if (count != n) passes.push_back(d);
+	}
+	const double histogram_time = elapsed_ms(start);
+
+	auto& buf = space.cubes;
+	buf.resize(n);
+	vector<Hist> offset(nt);
+	vector<double> pass_time;
+	for (size_t d : passes) {
+		auto pass_start = chrono::steady_clock::now();
+		parallel_chunks(n, nt, [&](unsigned t, size_t b, size_t e){
+			auto& h = offset[t];
+			h.fill(0);
+			for (size_t i = b; i < e; ++i) h[digit(ctr[i], d)]++;
+		});
+		// output position of the first element of each (digit value, chunk)
+		size_t pos = 0;
+		for (size_t v = 0; v < 256; ++v) {
+			for (unsigned t = 0; t < nt; ++t) {
+				const size_t cnt = offset[t][v];
+				offset[t][v] = pos;
+				pos += cnt;
+			}
+		}
+		parallel_chunks(n, nt, [&](unsigned t, size_t b, size_t e){
+			auto& o = offset[t];
+			for (size_t i = b; i < e; ++i) buf[o[digit(ctr[i], d)]++] = ctr[i];
+		});
+		ctr.swap(buf);
+		pass_time.push_back(elapsed_ms(pass_start));
+	}
+
+	if (log != nullptr) {
+		*log << " (radix sort with " << nt << " threads: histogram " << histogram_time << ", "
+			<< passes.size() << " of " << num_digits << " passes";
+		for (auto p : pass_time) *log << " " << p;
+		*log << ")";
+	}
+}
+
+void sort_cubes(vector<Cube>& ctr, const DenseCubicalGrids* dcg, const Config* config, CubeSortSpace& space){
+	// the timing and its detail only when they are printed (small images are sorted many times a second)
+	chrono::steady_clock::time_point start;
+	ostringstream detail;
+	if (config->verbose) start = chrono::steady_clock::now();
+	const size_t num_levels = dcg->levels.size();
+	const bool bucketed = num_levels > 0 && num_levels <= ctr.size();
+	if (bucketed) {
+		counting_sort(ctr, num_levels, space);
+		if (config->verbose) detail << " (counting sort over " << num_levels << " levels)";
+	} else if (ctr.size() >= RADIX_MIN_SIZE) {
+		radix_sort(ctr, resolve_threads(config->num_threads), space, config->verbose ? &detail : nullptr);
+	} else {
+		sort(ctr.begin(), ctr.end(), CubeComparator());
+	}
+	if(config->verbose){
+		cout << "Sorting took: " << elapsed_ms(start) << detail.str() << endl;
+	}
+}
@@ -0,0 +1,34 @@
+/* cube_sort.h
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+#include "config.h"
+#include "cube.h"
+
+class DenseCubicalGrids;
+
+// Sort cells in the order of CubeComparator (descending birth, ascending index).
+// When the filtration values are ranks with few levels, a stable counting sort over
+// the levels is used; this requires ctr to be in ascending order of index,
+// which is how the enumeration loops produce it.
+// Otherwise large lists are sorted by a parallel LSD radix sort on the births
+// (and on the indices as well, if they are not already ascending).
+// space is scratch storage, kept by the caller so that sorting the cells of the next
+// dimension or of the next image allocates nothing once it has grown.
+struct CubeSortSpace {
+	std::vector<Cube> cubes;
+	std::vector<size_t> counts;
+};
+void sort_cubes(std::vector<Cube>& ctr, const DenseCubicalGrids* dcg, const Config* config, CubeSortSpace& space);
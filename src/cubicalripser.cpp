@@ -28,6 +28,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "cube.h"
 #include "dense_cubical_grids.h"
 #include "write_pairs.h"
+#include "pair_writer.h"
 #include "joint_pairs.h"
 #include "compute_pairs.h"
 #include "config.h"
@@ -63,14 +64,24 @@ void print_usage() {
               << "                    link_find      (default)\n"
               << "                    compute_pairs  (slow in most cases)\n"
               << "  --min_recursion_to_cache, -mc  minimum number of recursion for a reduced column to be cached\n"
-              << "  --cache_size, -c    maximum number of reduced columns to be cached\n"
+              << "  --cache_size, -c    maximum number of reduced columns to be cached, or auto:\n"
+              << "                    chosen with the minimum recursion from the number of columns and --memory_budget\n"
+              << "  --memory_budget <MB>  memory for the cached columns with --cache_size auto (default 1024)\n"
               << "  --output, -o        name of the output file\n"
               << "  --print, -p         print persistence pairs on console\n"
               << "  --top_dim          compute only for top dimension using Alexander duality\n"
               << "  --embedded, -e      Take the Alexander dual\n"
+              << "  --rank              rank-transform the filtration values at load (same result, order-only)\n"
+              << "  --levels <n>        images with at most <n> distinct values are sorted by buckets (default 256, 0 to disable)\n"
+              << "  --threads <n>       number of worker threads (default 0: all hardware threads)\n"
+              << "  --mask <file>       compute only on the voxels where <file> (of the same shape) is nonzero\n"
               << "  --location, -l      whether creator/destroyer location is included in the output:\n"
               << "                    yes     (default)\n"
               << "                    none\n"
+              << "  --npy_layout        layout of the .npy output:\n"
+              << "                    matrix        float64 array with a column per field (default)\n"
+              << "                    structured    records of uint8 dim, float64 birth/death, int16/int32 coordinates\n"
+              << "                    structured32  as structured, with float32 birth/death\n"
               << std::endl;
 }
 
@@ -139,10 +150,23 @@ private:
             }
             else if (arg == "--cache_size" || arg == "-c") {
                 if (i + 1 >= argc) throw std::runtime_error("Missing cache size value");
+                std::string param(argv[++i]);
+                if (param == "auto") {
+                    config_.auto_cache = true;
+                } else {
+                    try {
+                        config_.cache_size = static_cast<uint32_t>(std::stoul(param));
+                    } catch (const std::exception& e) {
+                        throw std::runtime_error("Invalid cache size value");
+                    }
+                }
+            }
+            else if (arg == "--memory_budget") {
+                if (i + 1 >= argc) throw std::runtime_error("Missing memory budget value");
                 try {
-                    config_.cache_size = std::stoi(argv[++i]);
+                    config_.memory_budget = static_cast<uint64_t>(std::stod(argv[++i]) * (1 << 20));
                 } catch (const std::exception& e) {
-                    throw std::runtime_error("Invalid cache size value");
+                    throw std::runtime_error("Invalid memory budget value");
                 }
             }
             else if (arg == "--print" || arg == "-p") {
@@ -151,6 +175,29 @@ private:
             else if (arg == "--embedded" || arg == "-e") {
                 config_.embedded = true;
             }
+            else if (arg == "--levels") {
+                if (i + 1 >= argc) throw std::runtime_error("Missing levels value");
+                try {
+                    config_.bucket_levels = static_cast<uint32_t>(std::stoul(argv[++i]));
+                } catch (const std::exception& e) {
+                    throw std::runtime_error("Invalid levels value");
+                }
+            }
+            else if (arg == "--threads") {
+                if (i + 1 >= argc) throw std::runtime_error("Missing threads value");
+                try {
+                    config_.num_threads = std::stoi(argv[++i]);
+                } catch (const std::exception& e) {
+                    throw std::runtime_error("Invalid threads value");
+                }
+            }
+            else if (arg == "--mask") {
+                if (i + 1 >= argc) throw std::runtime_error("Missing mask filename");
+                config_.mask_filename = argv[++i];
+            }
+            else if (arg == "--rank") {
+                config_.rank = true;
+            }
             else if (arg == "--top_dim") {
                 config_.method = ALEXANDER;
             }
@@ -164,6 +211,22 @@ private:
                     throw std::runtime_error("Invalid location value");
                 }
             }
+            else if (arg == "--npy_layout") {
+                if (i + 1 >= argc) throw std::runtime_error("Missing npy_layout value");
+                std::string param(argv[++i]);
+                if (param == "matrix") {
+                    config_.npy = NPY_MATRIX;
+                }
+                else if (param == "structured") {
+                    config_.npy = NPY_STRUCTURED;
+                }
+                else if (param == "structured32") {
+                    config_.npy = NPY_STRUCTURED32;
+                }
+                else {
+                    throw std::runtime_error("Invalid npy_layout value");
+                }
+            }
             else {
                 if (!config_.filename.empty()) {
                     throw std::runtime_error("Multiple input files specified");
@@ -184,23 +247,32 @@ std::string get_file_extension(const std::string& filename) {
     return filename.substr(pos);
 }
 
-void determine_file_format(Config& config) {
+file_format determine_file_format(const std::string& filename) {
     static const std::unordered_map<std::string, file_format> format_map{{".txt", PERSEUS},
                                                                         {".npy", NUMPY},
+                                                                        {".npz", NPZ},
                                                                         {".csv", CSV},
                                                                         {".complex", DIPHA}};
 
-    std::string ext = get_file_extension(config.filename);
+    std::string ext = get_file_extension(filename);
     // Convert to lowercase
     std::transform(ext.begin(), ext.end(), ext.begin(),
                   [](unsigned char c){ return std::tolower(c); });
 
+    // gzip-compressed .npy and DIPHA files are decompressed while they are read
+    if (ext == ".gz") {
+        ext = get_file_extension(filename.substr(0, filename.size() - 3));
+        std::transform(ext.begin(), ext.end(), ext.begin(),
+                      [](unsigned char c){ return std::tolower(c); });
+        if (ext != ".npy" && ext != ".complex") ext = ".gz";
+    }
+
     auto it = format_map.find(ext);
     if (it == format_map.end()) {
         throw std::runtime_error(
-            "Unknown input file format (supported: .npy, .txt, .csv, .complex)");
+            "Unknown input file format (supported: .npy, .npz, .txt, .csv, .complex, .npy.gz, .complex.gz)");
     }
-    config.format = it->second;
+    return it->second;
 }
 
 bool file_exists(const std::string& filename) {
@@ -208,108 +280,10 @@ bool file_exists(const std::string& filename) {
     return f.good();
 }
 
-void write_output(const std::vector<WritePairs>& writepairs,
-                 const DenseCubicalGrids* dcg,
-                 const Config& config) {
-    const uint32_t pad_x = (dcg->ax - dcg->img_x) / 2;
-    const uint32_t pad_y = (dcg->ay - dcg->img_y) / 2;
-    const uint32_t pad_z = (dcg->az - dcg->img_z) / 2;
-    const uint32_t pad_w = (dcg->dim < 4) ? 0u : (dcg->aw - dcg->img_w) / 2;
-
-    const auto num_pairs = writepairs.size();
-    std::cout << "Total number of pairs: " << num_pairs << std::endl;
-
-    const std::string ext = get_file_extension(config.output_filename);
-    if (ext == ".csv") {
-        std::ofstream out(config.output_filename.c_str());
-        if (!out) {
-            throw std::runtime_error("Failed to open output file");
-        }
-
-        for (const auto& pair : writepairs) {
-            out << static_cast<unsigned int>(pair.dim) << "," << pair.birth << "," << pair.death;
-            if (config.location != LOC_NONE) {
-                if (dcg->dim < 4) {
-                    out << "," << pair.birth_x - pad_x
-                        << "," << pair.birth_y - pad_y
-                        << "," << pair.birth_z - pad_z
-                        << "," << pair.death_x - pad_x
-                        << "," << pair.death_y - pad_y
-                        << "," << pair.death_z - pad_z;
-                } else {
-                    out << "," << pair.birth_x - pad_x
-                        << "," << pair.birth_y - pad_y
-                        << "," << pair.birth_z - pad_z
-                        << "," << pair.birth_w - pad_w
-                        << "," << pair.death_x - pad_x
-                        << "," << pair.death_y - pad_y
-                        << "," << pair.death_z - pad_z
-                        << "," << pair.death_w - pad_w;
-                }
-            }
-            out << '\n';
-        }
-    }
-    else if (ext == ".npy") {
-        const size_t ncols = (dcg->dim < 4) ? 9 : 11; // dim,birth,death,(x1,y1,z1[,w1]),(x2,y2,z2[,w2])
-        const std::array<long unsigned, 2> shape = {num_pairs, static_cast<long unsigned>(ncols)};
-        std::vector<double> data(ncols * num_pairs, 0.0);
-
-        for (size_t i = 0; i < num_pairs; ++i) {
-            const auto& pair = writepairs[i];
-            const size_t base = ncols * i;
-            data[base + 0] = static_cast<double>(pair.dim);
-            data[base + 1] = pair.birth;
-            data[base + 2] = pair.death;
-            // birth coords
-            data[base + 3] = static_cast<double>(pair.birth_x) - pad_x;
-            data[base + 4] = static_cast<double>(pair.birth_y) - pad_y;
-            data[base + 5] = static_cast<double>(pair.birth_z) - pad_z;
-            size_t idx = 6;
-            if (dcg->dim >= 4) {
-                data[base + idx++] = static_cast<double>(pair.birth_w) - pad_w; // base+6
-            }
-            // death coords
-            data[base + idx++] = static_cast<double>(pair.death_x) - pad_x;
-            data[base + idx++] = static_cast<double>(pair.death_y) - pad_y;
-            data[base + idx++] = static_cast<double>(pair.death_z) - pad_z;
-            if (dcg->dim >= 4) {
-                data[base + idx++] = static_cast<double>(pair.death_w) - pad_w; // base+10
-            }
-        }
-
-        try {
-            npy::SaveArrayAsNumpy(config.output_filename, false, 2, shape.data(), data);
-        } catch (const std::exception& e) {
-            throw std::runtime_error("Failed to write NPY file: " + std::string(e.what()));
-        }
-    }
-    else if (config.output_filename != "none") {
-        std::ofstream out(config.output_filename.c_str(), std::ios::binary);
-        if (!out) {
-            throw std::runtime_error("Failed to open output file");
-        }
-
-        const int64_t magic_number = 8067171840;
-        const int64_t type = 2;  // PERSISTENCE_DIAGRAM
-        const int64_t num_points = num_pairs;
-
-        out.write(reinterpret_cast<const char*>(&magic_number), sizeof(int64_t));
-        out.write(reinterpret_cast<const char*>(&type), sizeof(int64_t));
-        out.write(reinterpret_cast<const char*>(&num_points), sizeof(int64_t));
-
-        for (const auto& pair : writepairs) {
-            const int64_t dim = pair.dim;
-            out.write(reinterpret_cast<const char*>(&dim), sizeof(int64_t));
-            out.write(reinterpret_cast<const char*>(&pair.birth), sizeof(double));
-            out.write(reinterpret_cast<const char*>(&pair.death), sizeof(double));
-        }
-    }
-}
-
 } // anonymous namespace
 
 int main(int argc, char** argv) {
+    std::string partial; // where the pairs written before an error are kept
     try {
         ArgumentParser parser(argc, argv);
         auto& config = const_cast<Config&>(parser.get_config());
@@ -318,7 +292,13 @@ int main(int argc, char** argv) {
             throw std::runtime_error("Input file not found: " + config.filename);
         }
 
-        determine_file_format(config);
+        config.format = determine_file_format(config.filename);
+        if (!config.mask_filename.empty()) {
+            if (!file_exists(config.mask_filename)) {
+                throw std::runtime_error("Mask file not found: " + config.mask_filename);
+            }
+            config.mask_format = determine_file_format(config.mask_filename);
+        }
 
         std::vector<WritePairs> writepairs;
         std::vector<uint64_t> betti;
@@ -328,11 +308,16 @@ int main(int argc, char** argv) {
         dcg.loadImage(config.embedded);
         config.maxdim = std::min<uint8_t>(config.maxdim, dcg.dim - 1);
 
+        // the pairs are written out as they are found, and when each dimension is done
+        PairWriter writer(&dcg, config);
+        if (!config.output_filename.empty()) partial = PairWriter::partialFilename(config.output_filename);
+        const auto num_pairs = [&]() { return writer.count() + writepairs.size(); };
+
         // Compute persistent homology
         switch (config.method) {
             case LINKFIND: {
                 Timer timer;
-                JointPairs jp(&dcg, writepairs, config);
+                JointPairs jp(&dcg, writepairs, config, &writer);
                 // Enumerate edges based on dimension
                 if (dcg.dim == 1) {
                     jp.enum_edges({0, 1}, ctr);
@@ -350,8 +335,9 @@ int main(int argc, char** argv) {
                 jp.joint_pairs_main(ctr, 0);
                 const auto msec = timer.milliseconds();
 
-                betti.push_back(writepairs.size());
+                betti.push_back(num_pairs());
                 std::cout << "Number of pairs in dim 0: " << betti[0] << std::endl;
+                writer.write(writepairs);
                 if (config.verbose) {
                     std::cout << "Computation took " << msec << " [msec]" << std::endl;
                 }
@@ -359,12 +345,13 @@ int main(int argc, char** argv) {
                 // Compute higher dimensions
                 if (config.maxdim > 0) {
                     Timer timer1;
-                    ComputePairs cp(&dcg, writepairs, config);
+                    ComputePairs cp(&dcg, writepairs, config, &writer);
                     cp.compute_pairs_main(ctr);  // dim1
 
-                    betti.push_back(writepairs.size() - betti[0]);
+                    betti.push_back(num_pairs() - betti[0]);
                     const auto msec1 = timer1.milliseconds();
                     std::cout << "Number of pairs in dim 1: " << betti[1] << std::endl;
+                    writer.write(writepairs);
                     if (config.verbose) {
                         std::cout << "Computation took " << msec1 << " [msec]" << std::endl;
                     }
@@ -375,8 +362,9 @@ int main(int argc, char** argv) {
                         cp.compute_pairs_main(ctr);  // dim2
 
                         const auto msec2 = timer2.milliseconds();
-                        betti.push_back(writepairs.size() - betti[0] - betti[1]);
+                        betti.push_back(num_pairs() - betti[0] - betti[1]);
                         std::cout << "Number of pairs in dim 2: " << betti[2] << std::endl;
+                        writer.write(writepairs);
                         if (config.verbose) {
                             std::cout << "Computation took " << msec2 << " [msec]" << std::endl;
                         }
@@ -386,8 +374,9 @@ int main(int argc, char** argv) {
                             cp.compute_pairs_main(ctr);  // dim3
 
                             const auto msec3 = timer3.milliseconds();
-                            betti.push_back(writepairs.size() - betti[0] - betti[1] - betti[2]);
+                            betti.push_back(num_pairs() - betti[0] - betti[1] - betti[2]);
                             std::cout << "Number of pairs in dim 3: " << betti[3] << std::endl;
+                            writer.write(writepairs);
                             if (config.verbose) {
                                 std::cout << "Computation took " << msec3 << " [msec]" << std::endl;
                             }
@@ -402,33 +391,37 @@ int main(int argc, char** argv) {
 
             case COMPUTEPAIRS: {
                 // TODO: bug in T-construction in PH0
-                ComputePairs cp(&dcg, writepairs, config);
+                ComputePairs cp(&dcg, writepairs, config, &writer);
                 // Dimension 0
                 cp.assemble_columns_to_reduce(ctr, 0);
                 cp.compute_pairs_main(ctr);
-                betti.push_back(writepairs.size());
+                betti.push_back(num_pairs());
                 std::cout << "Number of pairs in dim 0: " << betti[0] << std::endl;
+                writer.write(writepairs);
 
                 if (config.maxdim > 0) {
                     // Dimension 1
                     cp.assemble_columns_to_reduce(ctr, 1);
                     cp.compute_pairs_main(ctr);
-                    betti.push_back(writepairs.size() - betti[0]);
+                    betti.push_back(num_pairs() - betti[0]);
                     std::cout << "Number of pairs in dim 1: " << betti[1] << std::endl;
+                    writer.write(writepairs);
 
                     if (config.maxdim > 1) {
                         // Dimension 2
                         cp.assemble_columns_to_reduce(ctr, 2);
                         cp.compute_pairs_main(ctr);
-                        betti.push_back(writepairs.size() - betti[0] - betti[1]);
+                        betti.push_back(num_pairs() - betti[0] - betti[1]);
                         std::cout << "Number of pairs in dim 2: " << betti[2] << std::endl;
+                        writer.write(writepairs);
 
                         if (config.maxdim > 2) {
                             // Dimension 3
                             cp.assemble_columns_to_reduce(ctr, 3);
                             cp.compute_pairs_main(ctr);
-                            betti.push_back(writepairs.size() - betti[0] - betti[1] - betti[2]);
+                            betti.push_back(num_pairs() - betti[0] - betti[1] - betti[2]);
                             std::cout << "Number of pairs in dim 3: " << betti[3] << std::endl;
+                            writer.write(writepairs);
                         }
                     }
                 }
@@ -436,26 +429,26 @@ int main(int argc, char** argv) {
             }
 
             case ALEXANDER: {
-                if (config.tconstruction) {
+                if (dcg.tconstruction) {
                     throw std::runtime_error("Alexander duality for T-construction not implemented");
                 }
                 Timer timer;
-                JointPairs jp(&dcg, writepairs, config);
+                JointPairs jp(&dcg, writepairs, config, &writer);
 
                 if (dcg.dim == 1) {
                     jp.enum_edges({0}, ctr);
                     jp.joint_pairs_main(ctr, 0);
-                    std::cout << "Number of pairs in dim 0: " << writepairs.size() << std::endl;
+                    std::cout << "Number of pairs in dim 0: " << num_pairs() << std::endl;
                 }
                 else if (dcg.dim == 2) {
                     jp.enum_edges({0, 1, 3, 4}, ctr);
                     jp.joint_pairs_main(ctr, 1);
-                    std::cout << "Number of pairs in dim 1: " << writepairs.size() << std::endl;
+                    std::cout << "Number of pairs in dim 1: " << num_pairs() << std::endl;
                 }
                 else if (dcg.dim == 3) {
                     jp.enum_edges({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12}, ctr);
                     jp.joint_pairs_main(ctr, 2);
-                    std::cout << "Number of pairs in dim 2: " << writepairs.size() << std::endl;
+                    std::cout << "Number of pairs in dim 2: " << num_pairs() << std::endl;
                 }
                 else if (dcg.dim == 4) {
                     throw std::runtime_error("Alexander duality not implemented for 4D");
@@ -467,11 +460,17 @@ int main(int argc, char** argv) {
             }
         }
 
-        write_output(writepairs, &dcg, config);
+        writer.write(writepairs);
+        writer.close();
+        std::cout << "Total number of pairs: " << writer.count() << std::endl;
         return 0;
 
     } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << "Error: " << e.what();
+        if (!partial.empty() && file_exists(partial)) {
+            std::cerr << " (the pairs written before the error are kept in " << partial << ")";
+        }
+        std::cerr << std::endl;
         return 1;
     }
 }
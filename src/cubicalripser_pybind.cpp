@@ -45,8 +45,37 @@ PYBIND11_MODULE(CRIPSER_MODULE_NAME, m) {
 
     m.def("computePH", &computePH, "Compute Persistent Homology",
           py::arg("arr"),  py::arg("maxdim")=2, py::arg("top_dim")=false,
-          py::arg("embedded")=false, py::arg("location")="yes");
+          py::arg("embedded")=false, py::arg("location")="yes", py::arg("mask")=py::none(),
+          py::arg("threshold")=DBL_MAX, py::arg("method")="link_find", py::arg("cache_size")=py::none(),
+          py::arg("min_recursion_to_cache")=0, py::arg("maxiter")=1000000, py::arg("memory_budget")=1024.0,
+          py::arg("threads")=0, py::arg("on_pairs")=py::none());
+    m.def("computePH_batch", &computePH_batch, "Compute Persistent Homology of each image of a stack on a thread pool",
+          py::arg("arr"), py::arg("maxdim")=2, py::arg("top_dim")=false,
+          py::arg("embedded")=false, py::arg("threads")=0, py::arg("location")="yes",
+          py::arg("threshold")=DBL_MAX, py::arg("method")="link_find", py::arg("cache_size")=py::none(),
+          py::arg("min_recursion_to_cache")=0, py::arg("maxiter")=1000000, py::arg("memory_budget")=1024.0);
 
+    m.def("computePH_async", &computePH_async,
+          "Compute Persistent Homology on the native worker pool; returns a concurrent.futures.Future",
+          py::arg("arr"),  py::arg("maxdim")=2, py::arg("top_dim")=false,
+          py::arg("embedded")=false, py::arg("location")="yes", py::arg("mask")=py::none(),
+          py::arg("threshold")=DBL_MAX, py::arg("method")="link_find", py::arg("cache_size")=py::none(),
+          py::arg("min_recursion_to_cache")=0, py::arg("maxiter")=1000000, py::arg("memory_budget")=1024.0);
+    m.def("set_async_pool", &setAsyncPool, "Restart the worker pool of computePH_async",
+          py::arg("num_workers")=0, py::arg("max_queue")=0);
+    py::class_<Engine>(m, "Engine", "Compute Persistent Homology of images of a fixed shape, reusing the working space")
+        .def(py::init<py::object, int, bool, bool, const std::string&, double, const std::string&, py::object, int, int, double, int>(),
+             py::arg("shape"), py::arg("maxdim")=2, py::arg("top_dim")=false,
+             py::arg("embedded")=false, py::arg("location")="yes",
+             py::arg("threshold")=DBL_MAX, py::arg("method")="link_find", py::arg("cache_size")=py::none(),
+             py::arg("min_recursion_to_cache")=0, py::arg("maxiter")=1000000, py::arg("memory_budget")=1024.0,
+             py::arg("threads")=0)
+        .def_property_readonly("shape", &Engine::shape)
+        .def("compute", &Engine::compute, "Compute Persistent Homology of arr (of the shape of the engine); raises RuntimeError if called from on_pairs of the same engine",
+             py::arg("arr"), py::arg("on_pairs")=py::none());
+    m.def("_shutdown_async", &shutdownAsync);
+    // the workers are stopped before the interpreter is finalised
+    py::module_::import("atexit").attr("register")(m.attr("_shutdown_async"));
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
 #else
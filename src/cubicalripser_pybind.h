@@ -18,6 +18,18 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <unordered_map>
 #include <string>
 #include <cstdint>
+#include <stdexcept>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
 
 #if defined(_MSC_VER)
 #include <BaseTsd.h>
@@ -30,6 +42,9 @@ typedef SSIZE_T ssize_t;
 #include "compute_pairs.h"
 #include "config.h"
 #include "dense_cubical_grids.h"
+#include "pair_writer.h"
+#include "compute_ph.h"
+#include "dlpack.h"
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
@@ -38,117 +53,647 @@ using namespace std;
 
 namespace py = pybind11;
 
-/////////////////////////////////////////////
-py::array_t<double> computePH(py::array_t<double> img, int maxdim=3, bool top_dim=false, bool embedded=false, const std::string &location="yes"){
-	// we ignore "location" argument
+// pass the rows [first, first + n) to the Python callback on_pairs(dim, rows), a call for each dimension in them
+// (called from the computation with the GIL released)
+inline void deliverRows(const py::object &on_pairs, const RowBuffer &rows, size_t first, size_t n){
+	py::gil_scoped_acquire acquire;
+	const size_t nc = rows.columns();
+	const double *r = rows.data() + first * nc;
+	for(size_t b = 0, e = 0; b < n; b = e){
+		for(e = b + 1; e < n && r[e * nc] == r[b * nc]; ++e);
+		// a copy: the buffer of rows keeps growing
+		py::array_t<double> part(vector<ssize_t>{static_cast<ssize_t>(e - b), static_cast<ssize_t>(nc)});
+		std::copy_n(r + b * nc, (e - b) * nc, part.mutable_data());
+		on_pairs(static_cast<int>(r[b * nc]), part);
+	}
+}
+
+// the rows as a numpy array that takes over their buffer (no copy)
+inline py::array_t<double> adoptRows(RowBuffer& rows){
+	const vector<ssize_t> shape{static_cast<ssize_t>(rows.rows()), static_cast<ssize_t>(rows.columns())};
+	double *data = rows.release();
+	if(data == nullptr) return py::array_t<double>(shape);
+	py::capsule owner(data, [](void *p){ std::free(p); });
+	return py::array_t<double>(shape, data, owner);
+}
+
+// element types of the input read as they are (anything else is converted to float64);
+// births and deaths are their values, so they stay in the value domain of the input
+enum element_type { ELEM_FLOAT64, ELEM_FLOAT32, ELEM_BOOL, ELEM_UINT8, ELEM_INT8, ELEM_UINT16, ELEM_INT16,
+	ELEM_UINT32, ELEM_INT32, ELEM_UINT64, ELEM_INT64 };
+
+// an input array read in place: the element (i_0, i_1, ...) is at data + sum_k i_k * strides[k] elements
+struct InputView {
+	py::object owner; // keeps the memory alive
+	const void *data{nullptr};
+	element_type type{ELEM_FLOAT64};
+	int ndim{0};
+	int64_t shape[5]{1, 1, 1, 1, 1};
+	int64_t strides[5]{0, 0, 0, 0, 0};
+
+	// strides of the image (x,y,z,w) starting at dimension k (e.g. 1 for the images of a stack)
+	array<int64_t, 4> imageStrides(int k) const {
+		array<int64_t, 4> st{0, 0, 0, 0};
+		for (int j = k; j < ndim && j - k < 4; ++j) st[static_cast<size_t>(j - k)] = strides[j];
+		return st;
+	}
+
+	// the number of elements
+	uint64_t size() const {
+		uint64_t n = 1;
+		for (int j = 0; j < ndim; ++j) n *= static_cast<uint64_t>(shape[j]);
+		return n;
+	}
+};
+
+inline bool numpyElementType(const py::array &a, element_type &type){
+	if (py::isinstance<py::array_t<double>>(a)) type = ELEM_FLOAT64;
+	else if (py::isinstance<py::array_t<float>>(a)) type = ELEM_FLOAT32;
+	else if (py::isinstance<py::array_t<bool>>(a)) type = ELEM_BOOL;
+	else if (py::isinstance<py::array_t<uint8_t>>(a)) type = ELEM_UINT8;
+	else if (py::isinstance<py::array_t<int8_t>>(a)) type = ELEM_INT8;
+	else if (py::isinstance<py::array_t<uint16_t>>(a)) type = ELEM_UINT16;
+	else if (py::isinstance<py::array_t<int16_t>>(a)) type = ELEM_INT16;
+	else if (py::isinstance<py::array_t<uint32_t>>(a)) type = ELEM_UINT32;
+	else if (py::isinstance<py::array_t<int32_t>>(a)) type = ELEM_INT32;
+	else if (py::isinstance<py::array_t<uint64_t>>(a)) type = ELEM_UINT64;
+	else if (py::isinstance<py::array_t<int64_t>>(a)) type = ELEM_INT64;
+	else return false;
+	return true;
+}
+
+inline bool dlpackElementType(const DLDataType &dt, element_type &type){
+	if (dt.lanes != 1) return false;
+	switch (dt.code) {
+		case kDLFloat:
+			if (dt.bits == 64) { type = ELEM_FLOAT64; return true; }
+			if (dt.bits == 32) { type = ELEM_FLOAT32; return true; }
+			return false;
+		case kDLBool:
+			if (dt.bits == 8) { type = ELEM_BOOL; return true; }
+			return false;
+		case kDLUInt:
+		case kDLInt: {
+			const bool u = (dt.code == kDLUInt);
+			switch (dt.bits) {
+				case 8: type = u ? ELEM_UINT8 : ELEM_INT8; return true;
+				case 16: type = u ? ELEM_UINT16 : ELEM_INT16; return true;
+				case 32: type = u ? ELEM_UINT32 : ELEM_INT32; return true;
+				case 64: type = u ? ELEM_UINT64 : ELEM_INT64; return true;
+			}
+			return false;
+		}
+	}
+	return false;
+}
+
+// a numpy array in place; arrays of other dtypes (e.g. float16, or not in the native byte order)
+// are converted to float64, and those with strides that are not whole elements are copied
+inline InputView numpyView(py::array a){
+	InputView v;
+	if (!numpyElementType(a, v.type)) {
+		a = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(a);
+		v.type = ELEM_FLOAT64;
+	}
+	if (a.ndim() > 5) throw std::invalid_argument("arr has too many dimensions");
+	for (ssize_t k = 0; k < a.ndim(); ++k) {
+		if (a.shape(k) > 1 && a.strides(k) % a.itemsize() != 0) {
+			a = py::array::ensure(a, py::array::c_style);
+			break;
+		}
+	}
+	v.ndim = static_cast<int>(a.ndim());
+	for (int k = 0; k < v.ndim; ++k) {
+		// (the stride of an axis of length one is arbitrary, and never used)
+		v.shape[k] = a.shape(k);
+		v.strides[k] = (v.shape[k] > 1) ? a.strides(k) / a.itemsize() : 0;
+	}
+	v.data = a.data();
+	v.owner = a;
+	return v;
+}
+
+// a tensor exported by __dlpack__ (PyTorch, JAX, CuPy pinned memory, ...) in place;
+// tensors of other dtypes go through numpy.from_dlpack and are converted to float64
+inline InputView dlpackView(py::handle obj){
+	py::object capsule = obj.attr("__dlpack__")();
+	auto *managed = static_cast<DLManagedTensor*>(PyCapsule_GetPointer(capsule.ptr(), "dltensor"));
+	if (managed == nullptr) throw py::error_already_set();
+	const DLTensor &t = managed->dl_tensor;
+	if (t.device.device_type != kDLCPU && t.device.device_type != kDLCUDAHost) {
+		throw std::invalid_argument("arr should be on the CPU");
+	}
+	InputView v;
+	if (!dlpackElementType(t.dtype, v.type) || t.dtype.bits % 8 != 0) {
+		return numpyView(py::module_::import("numpy").attr("from_dlpack")(obj));
+	}
+	if (t.ndim > 5) throw std::invalid_argument("arr has too many dimensions");
+	v.ndim = t.ndim;
+	int64_t stride = 1;
+	for (int k = v.ndim - 1; k >= 0; --k) {
+		v.shape[k] = t.shape[k];
+		v.strides[k] = (t.strides != nullptr) ? t.strides[k] : stride;
+		stride *= t.shape[k];
+		// producers disagree on where data points for them (the first element or the lowest address)
+		if (v.strides[k] < 0 && v.shape[k] > 1) {
+			throw std::invalid_argument("arr should not have negative strides (pass a copy)");
+		}
+	}
+	v.data = static_cast<const char*>(t.data) + t.byte_offset;
+	// the capsule is not consumed, so the producer releases the tensor when it goes
+	v.owner = capsule;
+	return v;
+}
+
+// the input array, read in place whenever possible: numpy arrays, objects with __dlpack__,
+// and anything numpy.asarray accepts (converted)
+inline InputView inputView(py::handle arr){
+	if (py::isinstance<py::array>(arr)) return numpyView(py::reinterpret_borrow<py::array>(arr));
+	if (py::hasattr(arr, "__dlpack__")) return dlpackView(arr);
+	py::array a = py::array::ensure(arr);
+	if (!a) throw std::invalid_argument("arr should be an array");
+	return numpyView(a);
+}
+
+// call f with data as a pointer to the elements of the given type
+template <typename F>
+void withElements(const void *data, element_type type, F &&f){
+	switch (type) {
+		case ELEM_FLOAT64: f(static_cast<const double*>(data)); break;
+		case ELEM_FLOAT32: f(static_cast<const float*>(data)); break;
+		case ELEM_BOOL: f(static_cast<const bool*>(data)); break;
+		case ELEM_UINT8: f(static_cast<const uint8_t*>(data)); break;
+		case ELEM_INT8: f(static_cast<const int8_t*>(data)); break;
+		case ELEM_UINT16: f(static_cast<const uint16_t*>(data)); break;
+		case ELEM_INT16: f(static_cast<const int16_t*>(data)); break;
+		case ELEM_UINT32: f(static_cast<const uint32_t*>(data)); break;
+		case ELEM_INT32: f(static_cast<const int32_t*>(data)); break;
+		case ELEM_UINT64: f(static_cast<const uint64_t*>(data)); break;
+		case ELEM_INT64: f(static_cast<const int64_t*>(data)); break;
+	}
+}
+
+// settings of the computation on an image of dimension ndim
+inline Config makeConfig(uint8_t ndim, int maxdim, bool top_dim, bool embedded){
 	Config config;
 	config.format = NUMPY;
-
-	vector<WritePairs> writepairs; // (dim birth death x y z)
-	writepairs.reserve(1000);
-	//writepairs.clear();
-
-	std::unique_ptr<DenseCubicalGrids> dcg;
-	vector<Cube> ctr;
-
-    const auto &buff_info = img.request();
-    const auto &shape = buff_info.shape;
-	const uint8_t ndim = static_cast<uint8_t>(buff_info.ndim);
-	config.maxdim = maxdim;
-	const uint32_t sx = static_cast<uint32_t>(shape[0]);
-	const uint32_t sy = (ndim > 1) ? static_cast<uint32_t>(shape[1]) : 1u;
-	const uint32_t sz = (ndim > 2) ? static_cast<uint32_t>(shape[2]) : 1u;
-	const uint32_t sw = (ndim > 3) ? static_cast<uint32_t>(shape[3]) : 1u;
-	dcg = std::make_unique<DenseCubicalGrids>(config, ndim, sx, sy, sz, sw);
-	config.maxdim = std::min<uint8_t>(config.maxdim, dcg->dim - 1);
-	if(top_dim && dcg->dim > 1){
+	config.maxdim = std::min<int>(maxdim, ndim - 1);
+	if(top_dim && ndim > 1){
 		config.method = ALEXANDER;
 		config.embedded = !embedded;
 	}else{
 		config.embedded = embedded;
 	}
+	return config;
+}
 
-    bool fortran_order = img.flags() & py::array::f_style;
-	dcg -> gridFromArray(&img.data()[0], embedded, fortran_order);
-//	dense3[x][y][z] = -(*img.data(x-2, y-2, z-2));
-	dcg->finalisePadding();
-
-	// compute PH
-	if(config.method==ALEXANDER){
-		// compute PH
-		auto jp = std::make_unique<JointPairs>(dcg.get(), writepairs, config);
-		if(dcg->dim==1){
-			jp -> enum_edges({0},ctr);
-			jp -> joint_pairs_main(ctr,0); // dim0
-		}else if(dcg->dim==2){
-			jp -> enum_edges({0,1,3,4},ctr);
-			jp -> joint_pairs_main(ctr,1); // dim1
-		}else if(dcg->dim==3){
-			jp -> enum_edges({0,1,2,3,4,5,6,7,8,9,10,11,12},ctr);
-			jp -> joint_pairs_main(ctr,2); // dim2
+// the keyword arguments of computePH and computePH_batch setting the computation (as the options of the command line)
+inline void applyOptions(Config &config, double threshold, const std::string &method, const std::string &location,
+		py::object cache_size, int min_recursion_to_cache, int maxiter, double memory_budget){
+	config.threshold = threshold;
+	if(method == "compute_pairs"){
+		if(config.method != ALEXANDER) config.method = COMPUTEPAIRS;
+	}else if(method != "link_find"){
+		throw std::invalid_argument("method should be \"link_find\" or \"compute_pairs\"");
+	}
+	if(location == "none"){
+		config.location = LOC_NONE;
+	}else if(location != "yes"){
+		throw std::invalid_argument("location should be \"yes\" or \"none\"");
+	}
+	// None: no bound, "auto": chosen from the number of columns and memory_budget (MB)
+	if(py::isinstance<py::str>(cache_size)){
+		if(cache_size.cast<std::string>() != "auto"){
+			throw std::invalid_argument("cache_size should be None, a non-negative integer, or \"auto\"");
 		}
-	}else{
-        auto jp = std::make_unique<JointPairs>(dcg.get(), writepairs, config);
-        std::vector<uint32_t> betti;
-		if(dcg->dim==1){
-			jp -> enum_edges({0},ctr);
-		}else if(dcg->dim==2){
-			jp -> enum_edges({0,1},ctr);
-		}else if(dcg->dim==3){
-			jp -> enum_edges({0,1,2},ctr);
-		}else if(dcg->dim==4){
-			jp -> enum_edges({0,1,2,3},ctr);
-		}
-		jp -> joint_pairs_main(ctr,0); // dim0
-		betti.push_back(writepairs.size());
-		if(config.maxdim>0){
-			ComputePairs cp(dcg.get(), writepairs, config);
-	        //auto cp = std::make_unique<ComputePairs>(dcg.get(), writepairs, config);
-			cp.compute_pairs_main(ctr); // dim1
-			betti.push_back(writepairs.size() - betti[0]);
-			if(config.maxdim>1){
-				cp.assemble_columns_to_reduce(ctr,2);
-				cp.compute_pairs_main(ctr); // dim2
-				betti.push_back(writepairs.size() - betti[0] - betti[1]);
-				if (config.maxdim > 2) {
-					cp.assemble_columns_to_reduce(ctr, 3);
-					cp.compute_pairs_main(ctr);  // dim3
-					betti.push_back(writepairs.size() - betti[0] - betti[1] - betti[2]);
+		config.auto_cache = true;
+	}else if(!cache_size.is_none()){
+		const long long c = cache_size.cast<long long>();
+		if(c < 0){
+			throw std::invalid_argument("cache_size should be None, a non-negative integer, or \"auto\"");
+		}
+		config.cache_size = static_cast<uint32_t>(std::min<long long>(c, UINT32_MAX));
+	}
+	if(memory_budget <= 0){
+		throw std::invalid_argument("memory_budget should be positive");
+	}
+	config.min_recursion_to_cache = min_recursion_to_cache;
+	config.maxiter = maxiter;
+	config.memory_budget = static_cast<uint64_t>(memory_budget * (1 << 20));
+}
+
+// an image and the settings of its computation, taken from the arguments of computePH with the GIL held
+// (the Python objects it holds are to be released with the GIL held, too)
+struct PHJob {
+	InputView img;
+	py::array_t<double> mask; // keeps mask_ptr alive
+	const double *mask_ptr{nullptr};
+	bool mask_fortran_order{false};
+	bool embedded{false};
+	Config config;
+
+	size_t numColumns() const { return ::numColumns(static_cast<uint8_t>(img.ndim), config.location); }
+
+	bool small() const { return img.size() <= SMALL_IMAGE_VOXELS; }
+
+	// compute the rows of the pairs (touches no Python object).
+	// Small images are computed in the workspace kept by the thread for the next one; it is taken
+	// for the computation, so that a computePH called from on_pairs starts a workspace of its own
+	// (and one left by an exception is not used again).
+	void run(RowBuffer &rows, std::function<void(size_t, size_t)> on_rows=nullptr) const {
+		static thread_local std::unique_ptr<PHWorkspace> kept;
+		std::unique_ptr<PHWorkspace> ws;
+		if (small()) ws = std::move(kept);
+		if (!ws) ws = std::make_unique<PHWorkspace>();
+		const uint8_t ndim = static_cast<uint8_t>(img.ndim);
+		const uint32_t sx = static_cast<uint32_t>(img.shape[0]);
+		const uint32_t sy = static_cast<uint32_t>(img.shape[1]);
+		const uint32_t sz = static_cast<uint32_t>(img.shape[2]);
+		const uint32_t sw = static_cast<uint32_t>(img.shape[3]);
+		DenseCubicalGrids *dcg = ws->grid(config, ndim, sx, sy, sz, sw);
+		const array<int64_t, 4> strides = img.imageStrides(0);
+		withElements(img.data, img.type, [&](const auto *a){
+			dcg -> gridFromArray(a, embedded, strides, mask_ptr, mask_fortran_order);
+		});
+		dcg->finalisePadding();
+		ws->computeRows(rows, std::move(on_rows));
+		if (small()) kept = std::move(ws);
+	}
+};
+
+inline void prepareJob(PHJob &job, py::object arr, int maxdim, bool top_dim, bool embedded, const std::string &location, py::object mask,
+		double threshold, const std::string &method, py::object cache_size, int min_recursion_to_cache,
+		int maxiter, double memory_budget, int threads){
+	job.img = inputView(arr);
+	const InputView &img = job.img;
+	if (img.ndim < 1 || img.ndim > 4) {
+		throw std::invalid_argument("arr should be a 1,2,3, or 4 dimensional array");
+	}
+	const uint8_t ndim = static_cast<uint8_t>(img.ndim);
+	job.embedded = embedded;
+	job.config = makeConfig(ndim, maxdim, top_dim, embedded);
+	applyOptions(job.config, threshold, method, location, cache_size, min_recursion_to_cache, maxiter, memory_budget);
+	job.config.num_threads = imageThreads(img.size(), threads);
+
+	if (!mask.is_none()) {
+		// voxels where the mask is zero (False) are left out
+		py::array_t<double> m = py::array_t<double, py::array::forcecast>::ensure(mask);
+		if (!m || m.ndim() != img.ndim || !std::equal(img.shape, img.shape + img.ndim, m.shape())) {
+			throw std::invalid_argument("mask should be an array of the same shape as arr");
+		}
+		job.mask_fortran_order = (m.flags() & py::array::f_style) && !(m.flags() & py::array::c_style);
+		if (!(m.flags() & (py::array::c_style | py::array::f_style))) {
+			m = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(m);
+		}
+		job.mask = m;
+		job.mask_ptr = job.mask.data();
+	}
+}
+
+py::array_t<double> computePH(py::object arr, int maxdim=3, bool top_dim=false, bool embedded=false, const std::string &location="yes", py::object mask=py::none(),
+		double threshold=DBL_MAX, const std::string &method="link_find", py::object cache_size=py::none(), int min_recursion_to_cache=0,
+		int maxiter=1000000, double memory_budget=1024, int threads=0, py::object on_pairs=py::none()){
+	PHJob job;
+	prepareJob(job, arr, maxdim, top_dim, embedded, location, mask, threshold, method, cache_size,
+		min_recursion_to_cache, maxiter, memory_budget, threads);
+	RowBuffer rows(job.numColumns());
+	std::function<void(size_t, size_t)> on_rows;
+	if (!on_pairs.is_none()) {
+		on_rows = [&](size_t first, size_t n){ deliverRows(on_pairs, rows, first, n); };
+	}
+
+	// the GIL is released while the pairs are computed (the input is kept alive by job),
+	// so that computePH can run in several Python threads at once
+	{
+		py::gil_scoped_release release;
+		job.run(rows, on_rows);
+	}
+	return adoptRows(rows);
+}
+
+// PH of each image arr[i] of a stack, computed on a pool of threads (0: all hardware threads).
+// Each thread computes its images with a PHEngine, which keeps the working space for the next image.
+// The rows of the images are appended in order to the buffer of the result as the images are done
+// (those done ahead of an earlier image wait aside), so that the result is not copied at the end.
+// Returns the rows of all the images (as computePH, in the order of the images) and
+// the offsets of the rows of each image: those of arr[i] are result[offsets[i]:offsets[i+1]].
+py::tuple computePH_batch(py::object stack, int maxdim=3, bool top_dim=false, bool embedded=false, int threads=0,
+		const std::string &location="yes", double threshold=DBL_MAX, const std::string &method="link_find", py::object cache_size=py::none(),
+		int min_recursion_to_cache=0, int maxiter=1000000, double memory_budget=1024){
+	const InputView arr = inputView(stack);
+	if (arr.ndim < 2 || arr.ndim > 5) {
+		throw std::invalid_argument("arr should be a stack of 1,2,3, or 4 dimensional arrays");
+	}
+	const size_t n = static_cast<size_t>(arr.shape[0]);
+	const uint8_t ndim = static_cast<uint8_t>(arr.ndim - 1);
+	uint32_t s[4] = {1, 1, 1, 1};
+	for (uint8_t k = 0; k < ndim; ++k) {
+		s[k] = static_cast<uint32_t>(arr.shape[k + 1]);
+	}
+	const array<int64_t, 4> strides = arr.imageStrides(1);
+	Config config = makeConfig(ndim, maxdim, top_dim, embedded);
+	applyOptions(config, threshold, method, location, cache_size, min_recursion_to_cache, maxiter, memory_budget);
+	config.num_threads = 1; // the images are distributed over the threads
+	const size_t num_column = numColumns(ndim, config.location);
+	const unsigned num_workers = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(resolve_threads(threads), n)));
+
+	RowBuffer result(num_column);
+	vector<size_t> count(n);
+	std::mutex result_mutex;
+	size_t committed = 0; // the images [0, committed) are in result
+	std::map<size_t, RowBuffer> pending; // rows of the images done ahead of an earlier one
+	vector<std::exception_ptr> errors(num_workers);
+	{
+		py::gil_scoped_release release;
+		std::atomic<size_t> next{0};
+		parallel_chunks(num_workers, num_workers, [&](unsigned t, size_t, size_t){
+			try{
+				PHEngine engine(config, embedded, ndim, s[0], s[1], s[2], s[3]);
+				for (size_t i = next++; i < n; i = next++) {
+					RowBuffer rows(num_column);
+					withElements(arr.data, arr.type, [&](const auto *a){
+						engine.compute(a + static_cast<int64_t>(i) * arr.strides[0], strides, rows);
+					});
+					count[i] = rows.rows();
+					std::lock_guard<std::mutex> lock(result_mutex);
+					pending.emplace(i, std::move(rows));
+					while (!pending.empty() && pending.begin()->first == committed) {
+						const RowBuffer &done = pending.begin()->second;
+						std::copy_n(done.data(), done.rows() * num_column, result.append(done.rows()));
+						pending.erase(pending.begin());
+						++committed;
+					}
 				}
+			} catch (...) {
+				errors[t] = std::current_exception();
 			}
+		});
+	}
+	for (auto &e : errors) {
+		if (e) std::rethrow_exception(e);
+	}
+
+	py::array_t<int64_t> offsets(static_cast<ssize_t>(n + 1));
+	int64_t *offsets_ptr = offsets.mutable_data();
+	offsets_ptr[0] = 0;
+	for (size_t i = 0; i < n; ++i) {
+		offsets_ptr[i + 1] = offsets_ptr[i] + static_cast<int64_t>(count[i]);
+	}
+	return py::make_tuple(adoptRows(result), offsets);
+}
+
+// the exception thrown by the computation as a Python exception object (as pybind11 translates it)
+inline py::object pythonException(std::exception_ptr error){
+	py::module_ builtins = py::module_::import("builtins");
+	try {
+		std::rethrow_exception(error);
+	} catch (py::error_already_set &e) {
+		return e.value();
+	} catch (const std::invalid_argument &e) {
+		return builtins.attr("ValueError")(e.what());
+	} catch (const std::bad_alloc &) {
+		return builtins.attr("MemoryError")();
+	} catch (const std::exception &e) {
+		return builtins.attr("RuntimeError")(e.what());
+	} catch (...) {
+		return builtins.attr("RuntimeError")("Unknown error");
+	}
+}
+
+// Native worker threads computing PHJobs submitted by computePH_async, each one image at a time
+// (with one thread). At most max_queue jobs wait for a worker: submit() blocks while the queue is full.
+// A job completes its concurrent.futures.Future with the result of computePH (or the exception).
+class AsyncPool {
+public:
+	AsyncPool(unsigned num_workers, size_t _max_queue) : max_queue(std::max<size_t>(1, _max_queue)) {
+		for (unsigned t = 0; t < num_workers; ++t) {
+			workers.emplace_back([this](){ work(); });
+		}
+	}
+	~AsyncPool() {
+		// the workers have been joined by shutdown(), unless the pool failed to start (with nothing queued)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		not_empty.notify_all();
+		for (auto &t : workers) {
+			if (t.joinable()) t.join();
 		}
 	}
+	AsyncPool(const AsyncPool&) = delete;
+	AsyncPool& operator=(const AsyncPool&) = delete;
 
-	// result
-	// determine shift between dcg and the voxel coordinates
-	auto pad_x = (dcg->ax - dcg->img_x)/2;
-	auto pad_y = (dcg->ay - dcg->img_y)/2;
-	auto pad_z = (dcg->az - dcg->img_z)/2;
-	auto pad_w = (dcg->aw - dcg->img_w)/2;
-	int num_column = 9;
-	int shift_column = 0;
-	if (dcg->dim > 3) {
-		num_column = 11;
-		shift_column = 1;
-	};
-	int64_t p = writepairs.size();
-	vector<ssize_t> result_shape{p,num_column};
-	py::array_t<double> data{result_shape};
-	auto data_ptr = data.mutable_data();
-	for(int64_t i = 0; i < p; ++i){
-        data_ptr[i * num_column + 0] = writepairs[i].dim;
-        data_ptr[i * num_column + 1] = writepairs[i].birth;
-        data_ptr[i * num_column + 2] = writepairs[i].death;
-        data_ptr[i * num_column + 3] = writepairs[i].birth_x - pad_x;
-        data_ptr[i * num_column + 4] = writepairs[i].birth_y - pad_y;
-        data_ptr[i * num_column + 5] = writepairs[i].birth_z - pad_z;
-        data_ptr[i * num_column + 6 + shift_column] = writepairs[i].death_x - pad_x;
-        data_ptr[i * num_column + 7 + shift_column] = writepairs[i].death_y - pad_y;
-        data_ptr[i * num_column + 8 + shift_column] = writepairs[i].death_z - pad_z;
-		if (dcg->dim > 3) {
-			data_ptr[i * num_column + 6] = writepairs[i].birth_w - pad_w;
-			data_ptr[i * num_column + 9] = writepairs[i].death_w - pad_w;
-		};
+	// enqueue the job (GIL held; released while waiting for room in the queue)
+	void submit(std::unique_ptr<PHJob> job, py::object future) {
+		{
+			py::gil_scoped_release release;
+			std::unique_lock<std::mutex> lock(mutex);
+			not_full.wait(lock, [&](){ return stopping || queue.size() < max_queue; });
+			if (!stopping) {
+				queue.push_back({std::move(job), std::move(future)});
+				not_empty.notify_one();
+				return;
+			}
+		}
+		// the job and future are released here with the GIL held
+		throw std::runtime_error("The async pool has been shut down");
+	}
+
+	// cancel the waiting jobs and wait for the running ones (GIL held)
+	void shutdown() {
+		std::deque<Task> cancelled;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			cancelled.swap(queue);
+		}
+		not_empty.notify_all();
+		not_full.notify_all();
+		for (auto &task : cancelled) {
+			task.future.attr("cancel")();
+		}
+		cancelled.clear();
+		py::gil_scoped_release release;
+		for (auto &t : workers) {
+			if (t.joinable()) t.join();
+		}
+	}
+
+private:
+	struct Task {
+		std::unique_ptr<PHJob> job;
+		py::object future;
 	};
-	return data;
+
+	void work() {
+		for (;;) {
+			Task task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				not_empty.wait(lock, [&](){ return stopping || !queue.empty(); });
+				if (queue.empty()) return;
+				task = std::move(queue.front());
+				queue.pop_front();
+			}
+			not_full.notify_one();
+			{
+				// a future cancelled while waiting is dropped
+				py::gil_scoped_acquire acquire;
+				if (!task.future.attr("set_running_or_notify_cancel")().cast<bool>()) {
+					task = Task();
+					continue;
+				}
+			}
+			RowBuffer rows(task.job->numColumns());
+			std::exception_ptr error;
+			try {
+				task.job->run(rows);
+			} catch (...) {
+				error = std::current_exception();
+			}
+			py::gil_scoped_acquire acquire;
+			try {
+				if (error) {
+					task.future.attr("set_exception")(pythonException(error));
+				} else {
+					task.future.attr("set_result")(adoptRows(rows));
+				}
+			} catch (py::error_already_set &e) {
+				// e.g. out of memory for the result
+				task.future.attr("set_exception")(e.value());
+			}
+			task = Task(); // the input and the future are released with the GIL held
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable not_empty, not_full;
+	std::deque<Task> queue;
+	bool stopping{false};
+	size_t max_queue;
+	vector<std::thread> workers;
+};
+
+// the pool of computePH_async, started on first use (GIL held for all accesses).
+// It is never destroyed (the interpreter may be gone by then); shutdownAsync stops it at exit.
+inline std::shared_ptr<AsyncPool>& asyncPool(){
+	static auto *pool = new std::shared_ptr<AsyncPool>();
+	return *pool;
+}
+
+// (re)start the pool with num_workers threads (0: all hardware threads) and at most max_queue waiting jobs
+// (0: twice the number of workers); the waiting jobs of the previous pool are cancelled, and the running ones completed
+inline void setAsyncPool(int num_workers=0, int max_queue=0){
+	if (num_workers < 0 || max_queue < 0) {
+		throw std::invalid_argument("num_workers and max_queue should be non-negative");
+	}
+	std::shared_ptr<AsyncPool> &pool = asyncPool();
+	if (pool) {
+		std::shared_ptr<AsyncPool> old = std::move(pool);
+		old->shutdown();
+	}
+	const unsigned nw = resolve_threads(num_workers);
+	pool = std::make_shared<AsyncPool>(nw, max_queue > 0 ? static_cast<size_t>(max_queue) : 2 * size_t(nw));
+}
+
+inline void shutdownAsync(){
+	std::shared_ptr<AsyncPool> &pool = asyncPool();
+	if (pool) {
+		std::shared_ptr<AsyncPool> old = std::move(pool);
+		old->shutdown();
+	}
+}
+
+// computePH on the native worker pool: returns a concurrent.futures.Future of its result at once
+// (use asyncio.wrap_future to await it). Blocks while the queue of the pool is full.
+py::object computePH_async(py::object arr, int maxdim=3, bool top_dim=false, bool embedded=false, const std::string &location="yes", py::object mask=py::none(),
+		double threshold=DBL_MAX, const std::string &method="link_find", py::object cache_size=py::none(), int min_recursion_to_cache=0,
+		int maxiter=1000000, double memory_budget=1024){
+	auto job = std::make_unique<PHJob>();
+	// each worker computes one image with one thread
+	prepareJob(*job, arr, maxdim, top_dim, embedded, location, mask, threshold, method, cache_size,
+		min_recursion_to_cache, maxiter, memory_budget, 1);
+	if (!asyncPool()) setAsyncPool();
+	std::shared_ptr<AsyncPool> pool = asyncPool(); // kept while waiting for room
+	py::object future = py::module_::import("concurrent.futures").attr("Future")();
+	pool->submit(std::move(job), future);
+	return future;
 }
+
+
+// A PHEngine for Python: computePH of image after image of the shape given at construction,
+// with the settings given at construction (as the keyword arguments of computePH).
+// Calls of compute on an engine from several threads run one at a time; an engine for each thread
+// computes in parallel.
+class Engine {
+public:
+	Engine(py::object shape, int maxdim, bool top_dim, bool embedded, const std::string &location,
+			double threshold, const std::string &method, py::object cache_size, int min_recursion_to_cache,
+			int maxiter, double memory_budget, int threads){
+		std::vector<int64_t> extents;
+		for (py::handle e : shape) extents.push_back(e.cast<int64_t>());
+		if (extents.empty() || extents.size() > 4) {
+			throw std::invalid_argument("shape should be of a 1,2,3, or 4 dimensional array");
+		}
+		uint32_t s[4] = {1, 1, 1, 1};
+		uint64_t voxels = 1;
+		for (size_t k = 0; k < extents.size(); ++k) {
+			if (extents[k] < 1 || extents[k] > INT32_MAX) throw std::invalid_argument("invalid extent in shape");
+			s[k] = static_cast<uint32_t>(extents[k]);
+			voxels *= s[k];
+		}
+		const uint8_t ndim = static_cast<uint8_t>(extents.size());
+		Config config = makeConfig(ndim, maxdim, top_dim, embedded);
+		applyOptions(config, threshold, method, location, cache_size, min_recursion_to_cache, maxiter, memory_budget);
+		config.num_threads = imageThreads(voxels, threads);
+		engine = std::make_unique<PHEngine>(config, embedded, ndim, s[0], s[1], s[2], s[3]);
+	}
+
+	py::tuple shape() const {
+		py::list extents;
+		for (uint8_t k = 0; k < engine->dimension(); ++k) extents.append(engine->extents()[k]);
+		return py::tuple(extents);
+	}
+
+	// the rows of the pairs of arr (of the shape of the engine), as computePH.
+	// Calls from several threads take turns; a call from on_pairs (on the thread computing)
+	// raises RuntimeError instead of waiting for itself.
+	py::array_t<double> compute(py::object arr, py::object on_pairs=py::none()){
+		if (owner.load() == std::this_thread::get_id()) {
+			throw std::runtime_error("Engine.compute called from on_pairs of the same engine");
+		}
+		const InputView img = inputView(arr);
+		bool same = (img.ndim == engine->dimension());
+		for (int k = 0; same && k < img.ndim; ++k) same = (img.shape[k] == engine->extents()[k]);
+		if (!same) {
+			throw std::invalid_argument("arr should be of the shape of the engine");
+		}
+		RowBuffer rows(engine->numColumns());
+		std::function<void(size_t, size_t)> on_rows;
+		if (!on_pairs.is_none()) {
+			on_rows = [&](size_t first, size_t n){ deliverRows(on_pairs, rows, first, n); };
+		}
+		{
+			py::gil_scoped_release release;
+			std::lock_guard<std::mutex> lock(mutex);
+			const Owner owned(owner);
+			withElements(img.data, img.type, [&](const auto *a){
+				engine->compute(a, img.imageStrides(0), rows, on_rows);
+			});
+		}
+		return adoptRows(rows);
+	}
+
+private:
+	// the thread holding mutex, while it holds it
+	struct Owner {
+		std::atomic<std::thread::id>& id;
+		explicit Owner(std::atomic<std::thread::id>& _id) : id(_id) { id = std::this_thread::get_id(); }
+		~Owner() { id = std::thread::id(); }
+	};
+
+	std::unique_ptr<PHEngine> engine;
+	std::mutex mutex; // held while computing
+	std::atomic<std::thread::id> owner{};
+};
@@ -21,22 +21,27 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 using namespace std;
 
 
-DenseCubicalGrids::DenseCubicalGrids(Config& _config)  {
+DenseCubicalGrids::DenseCubicalGrids(const Config& _config) : tconstruction(false) {
     config = &_config;
     threshold = config->threshold;
-    config->tconstruction = false;
 }
 
 // Explicit-shape constructor (V-construction)
-DenseCubicalGrids::DenseCubicalGrids(Config& _config, uint8_t d, uint32_t x, uint32_t y, uint32_t z, uint32_t w)  {
+DenseCubicalGrids::DenseCubicalGrids(const Config& _config, uint8_t d, uint32_t x, uint32_t y, uint32_t z, uint32_t w) : tconstruction(false) {
     config = &_config;
     threshold = config->threshold;
-    config->tconstruction = false;
     dim = d;
     ax = x; ay = y; az = z; aw = w;
     img_x = ax; img_y = ay; img_z = az; img_w = aw;
 }
 
+// the other end of an edge of type m (3D; types 3 to 12 are the diagonal edges used for Alexander duality)
+static const int edge_offsets[13][3] = {
+	{1,0,0},{0,1,0},{0,0,1},{1,1,0},{1,-1,0},
+	{0,-1,1},{0,1,1},{1,-1,1},{1,0,1},{1,1,1},
+	{1,-1,-1},{1,0,-1},{1,1,-1}
+};
+
 // return filtlation value for a cube
 // (cx,cy,cz) is the voxel coordinates in the original image
 double DenseCubicalGrids::getBirth(uint32_t cx, uint32_t cy, uint32_t cz){
@@ -50,14 +55,9 @@ double DenseCubicalGrids::getBirth(uint32_t cx, uint32_t cy, uint32_t cz, uint32
 			case 0:
 				return (*dense)(cx+1, cy+1, cz+1);
 			case 1: {
-				static const int off[13][3] = {
-					{1,0,0},{0,1,0},{0,0,1},{1,1,0},{1,-1,0},
-					{0,-1,1},{0,1,1},{1,-1,1},{1,0,1},{1,1,1},
-					{1,-1,-1},{1,0,-1},{1,1,-1}
-				};
 				if (cm < 13) {
 					const double b = (*dense)(cx+1, cy+1, cz+1);
-					const int *o = off[cm];
+					const int *o = edge_offsets[cm];
 					return max(b, (*dense)(cx+1+o[0], cy+1+o[1], cz+1+o[2]));
 				}
 				// fallthrough on invalid cm
@@ -159,34 +159,53 @@ double DenseCubicalGrids::getBirth(uint32_t cx, uint32_t cy, uint32_t cz, uint32
 }
 
 
-// (x,y,z) or (x,y,z,w) of the voxel which defines the birthtime of the cube
-vector<uint32_t> DenseCubicalGrids::ParentVoxel(uint8_t _dim, Cube &c){
-	(void)_dim;
-	uint32_t cx = c.x(), cy = c.y(), cz = c.z(), cw = c.w();
-
-	if (dim < 4) {
-		static const int rel[][3] = {
-			{0,0,0},{1,0,0},{1,1,0},{0,1,0},{0,0,1},{1,0,1},{0,1,1},{1,1,1},
-			{1,-1,0},{0,-1,1},{1,-1,1},{1,-1,-1},{1,0,-1},{1,1,-1}
-		};
-		for (auto &r : rel) {
-			int dx=r[0], dy=r[1], dz=r[2];
-			if (c.birth == (*dense)(cx+1+dx, cy+1+dy, cz+1+dz))
-				return {cx+dx, cy+dy, cz+dz};
+// (x,y,z,w) of the voxel which defines the birthtime of the cube:
+// the first vertex of the cell with the maximum value (w is 0 for images of dim < 4)
+array<uint32_t, 4> DenseCubicalGrids::birthVoxel(uint8_t _dim, const Cube &c){
+	uint32_t cx, cy, cz, cw;
+	layout.decode(c.index, cx, cy, cz, cw);
+	const uint8_t m = c.m();
+	const auto &d = dense->data();
+	const uint64_t v = c.voxel();
+	if (dim < 4 && _dim == 1 && m >= 3) {
+		// diagonal edge
+		const int *o = edge_offsets[m];
+		const uint64_t u = v + layout.offset(o[0], o[1], o[2], 0);
+		if (d[u] > d[v]) {
+			return {static_cast<uint32_t>(int64_t(cx) + o[0]), static_cast<uint32_t>(int64_t(cy) + o[1]), static_cast<uint32_t>(int64_t(cz) + o[2]), 0};
 		}
-	} else {
-		// 4D case
-		static const int rel4d[][4] = {
-			{0,0,0,0},{1,0,0,0},{1,1,0,0},{0,1,0,0},{0,0,1,0},{1,0,1,0},{0,1,1,0},{1,1,1,0},
-			{0,0,0,1},{1,0,0,1},{1,1,0,1},{0,1,0,1},{0,0,1,1},{1,0,1,1},{0,1,1,1},{1,1,1,1},
-			{1,-1,0,0},{0,-1,1,0},{1,-1,1,0},{1,-1,-1,0},{1,0,-1,0},{1,1,-1,0}
-		};
-		for (auto &r : rel4d) {
-			int dx=r[0], dy=r[1], dz=r[2], dw=r[3];
-			if (c.birth == (*dense)(cx+1+dx, cy+1+dy, cz+1+dz, cw+1+dw))
-				return {uint32_t(cx+dx), uint32_t(cy+dy), uint32_t(cz+dz), uint32_t(cw+dw)};
+		return {cx, cy, cz, 0};
+	}
+	// vertices (as subsets of the axes) in the order of preference on ties
+	static const uint8_t order[16] = {0,1,3,2,4,5,6,7, 8,9,11,10,12,13,14,15};
+	const uint8_t span = cellSpan(_dim, m, dim > 3);
+	uint8_t best = 0;
+	double best_value = d[v];
+	for (uint8_t k = 1; k < 16; ++k) {
+		const uint8_t s = order[k];
+		if (s & ~span) continue;
+		const double value = d[v + layout.offset(s & 1, (s >> 1) & 1, (s >> 2) & 1, (s >> 3) & 1)];
+		if (value > best_value) {
+			best = s;
+			best_value = value;
+		}
+	}
+	return {cx + (best & 1u), cy + ((best >> 1) & 1u), cz + ((best >> 2) & 1u), cw + ((best >> 3) & 1u)};
+}
+
+// a cell is born no earlier than the voxel at its anchor, so a row of cells
+// can be skipped when the corresponding row of voxels is above the threshold
+void DenseCubicalGrids::buildRowMask(){
+	const vector<uint8_t> rows = denseRowsBelowThreshold();
+	const auto &s = dense->shape();
+	const uint32_t w1 = (dim < 4) ? 0 : 1;
+	row_active.assign(static_cast<size_t>(ay) * az * aw, 0);
+	size_t i = 0;
+	for (uint32_t w = 0; w < aw; ++w) {
+		for (uint32_t z = 0; z < az; ++z) {
+			for (uint32_t y = 0; y < ay; ++y) {
+				row_active[i++] = rows[(y+1) + s[1] * ((z+1) + s[2] * (w+w1))];
+			}
 		}
 	}
-	cerr << "parent voxel not found!" << endl;
-	return dim < 4 ? vector<uint32_t>{0,0,0} : vector<uint32_t>{0,0,0,0};
 }
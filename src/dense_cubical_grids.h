@@ -20,14 +20,34 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <cassert>
 #include <memory>
 #include <array>
+#include <utility>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
 
 #include "config.h"
 #include "cube.h"
 #include "npy.hpp"
+#include "parallel.h"
+#include "mapped_file.h"
+#include "text_parser.h"
+#include "byte_reader.h"
+#include "index_map.h"
 
 using namespace std;
 
+// An input array: the values parsed from a text file, or a view of the data in a mapped binary file
+struct InputArray {
+	vector<double> values;
+	unique_ptr<MappedFile> file;
+	const double* mapped{nullptr};
+
+	const double* data() const { return mapped ? mapped : values.data(); }
+};
+
 template<typename T>
 class NDArray {
 private:
@@ -40,8 +60,9 @@ public:
         size_t total_size = 1;
         strides_.resize(dims.size());
 
-        // Calculate strides (row-major order)
-        for (int i = dims.size() - 1; i >= 0; --i) {
+        // Calculate strides (column-major order: the first index runs fastest,
+        // so that the flat index agrees with the voxel part of Cube::index)
+        for (size_t i = 0; i < dims.size(); ++i) {
             strides_[i] = total_size;
             total_size *= dimensions_[i];
         }
@@ -57,167 +78,370 @@ public:
         }
         return data_[flat_index];
     }
+
+    const std::vector<size_t>& shape() const { return dimensions_; }
+    std::vector<T>& data() { return data_; }
 };
 
 class DenseCubicalGrids{
 public:
-	Config *config;
+	const Config *config;
+	const bool tconstruction; // T-construction or V-construction (fixed by the library linked)
 	double threshold;
 	uint8_t dim;
 	uint32_t img_x, img_y, img_z, img_w;
 	uint32_t ax, ay, az, aw;
-    uint32_t axy, axyz, ayz, azw, axw, ayw;
+    uint64_t axy, axyz, ayz, azw, axw, ayw;
 	std::unique_ptr<NDArray<double>> dense;
+	CubeLayout layout; // encoding of cell coordinates into Cube::index
+	vector<double> levels; // sorted distinct filtration values when rank-transformed (empty otherwise)
+	vector<pair<double, uint32_t>> rank_space; // kept for rankTransform of the next small grid
+	IndexMap level_bits; // kept for rankIfFewLevels of the next grid
+	uint32_t crop_x{0}, crop_y{0}, crop_z{0}, crop_w{0}; // position of the grid in the input image (nonzero when cropped to the bounding box of a mask)
+	bool masked{false};
+	vector<uint8_t> row_active; // for each row (y,z,w) of cells, whether it may contain a cell born below the threshold (empty: all rows)
 
-    DenseCubicalGrids(Config&);
+    DenseCubicalGrids(const Config&);
     // Overloaded constructor allowing explicit shape initialization
-    DenseCubicalGrids(Config&, uint8_t dim, uint32_t ax, uint32_t ay = 1, uint32_t az = 1, uint32_t aw = 1);
+    DenseCubicalGrids(const Config&, uint8_t dim, uint32_t ax, uint32_t ay = 1, uint32_t az = 1, uint32_t aw = 1);
 	~DenseCubicalGrids() = default; // NDArray uses RAII, no manual cleanup needed
 	double getBirth(uint32_t x, uint32_t y, uint32_t z);
 	double getBirth(uint32_t x, uint32_t y, uint32_t z, uint32_t w, uint8_t cm, uint8_t dim);
-	vector<uint32_t> ParentVoxel(uint8_t _dim, Cube &c);
+	array<uint32_t, 4> birthVoxel(uint8_t _dim, const Cube &c);
+	void buildRowMask();
+
+	bool rowActive(uint32_t y, uint32_t z, uint32_t w) const {
+		return row_active.empty() || row_active[y + ay * (z + static_cast<uint64_t>(az) * w)];
+	}
+
+	// Append to ctr the cells of the given types in ascending order of index.
+	// emit(m, y, z, w, out) appends the selected cells of the row (y,z,w) of type m to out.
+	// The rows are split into contiguous slabs, one per thread, and the per-thread lists
+	// are concatenated in order. A single thread appends to ctr directly (keeping its storage).
+	template <typename F>
+	void collectCells(const vector<uint8_t>& types, unsigned num_threads, vector<Cube>& ctr, F&& emit) {
+		const uint64_t rows = static_cast<uint64_t>(ay) * az * aw;
+		const bool direct = (num_threads == 1);
+		vector<vector<Cube>> local(direct ? 0 : num_threads);
+		const unsigned nt = parallel_chunks(rows * types.size(), num_threads, [&](unsigned t, size_t b, size_t e){
+			auto& out = direct ? ctr : local[t];
+			out.reserve(out.size() + (e - b) * ax / 4);
+			for (size_t r = b; r < e; ++r) {
+				const uint8_t m = types[r / rows];
+				uint64_t row = r % rows;
+				const uint32_t y = static_cast<uint32_t>(row % ay); row /= ay;
+				const uint32_t z = static_cast<uint32_t>(row % az);
+				const uint32_t w = static_cast<uint32_t>(row / az);
+				if (rowActive(y, z, w)) emit(m, y, z, w, out);
+			}
+		});
+		if (direct) return;
+		if (nt == 1 && ctr.empty()) {
+			ctr.swap(local[0]);
+			return;
+		}
+		vector<size_t> offset(nt + 1, ctr.size());
+		for (unsigned t = 0; t < nt; ++t) offset[t + 1] = offset[t] + local[t].size();
+		ctr.resize(offset[nt]);
+		parallel_chunks(nt, nt, [&](unsigned, size_t b, size_t e){
+			for (size_t t = b; t < e; ++t) {
+				copy(local[t].begin(), local[t].end(), ctr.begin() + static_cast<ptrdiff_t>(offset[t]));
+				vector<Cube>().swap(local[t]);
+			}
+		});
+	}
+
+	// start over with an input of the given shape (as the explicit-shape constructor);
+	// gridFromArray reuses the grid of the previous input when the padded shape agrees
+	void reset(uint8_t d, uint32_t x, uint32_t y = 1, uint32_t z = 1, uint32_t w = 1){
+		threshold = config->threshold;
+		dim = d;
+		ax = x; ay = y; az = z; aw = w;
+		img_x = ax; img_y = ay; img_z = az; img_w = aw;
+		crop_x = crop_y = crop_z = crop_w = 0;
+		masked = false;
+		row_active.clear();
+		levels.clear();
+	}
+
+	// Grids of at most this many (padded) voxels are always rank-transformed: sorting their voxels once
+	// lets the cells of every dimension be sorted by counting, which is faster than comparing the cells
+	// when they are too few for the radix sort.
+	static constexpr size_t RANK_SMALL_GRID = 1 << 14;
 
 	void finalisePadding(){
 		// T-construction (the number of vertices = that of the top cells plus one, in each dimension)
-		if(config->tconstruction){
+		if(tconstruction){
 			if(dim>3) aw++;
 			if(dim>2) az++;
 			ax++;
 			ay++;
 		}
-		axy = ax * ay;
-		ayz = ay * az;
-		azw = az * aw;
-		axw = ax * aw;
-		ayw = ay * aw;
-		axyz = ax * ay * az;
+		axy = static_cast<uint64_t>(ax) * ay;
+		ayz = static_cast<uint64_t>(ay) * az;
+		azw = static_cast<uint64_t>(az) * aw;
+		axw = static_cast<uint64_t>(ax) * aw;
+		ayw = static_cast<uint64_t>(ay) * aw;
+		axyz = axy * az;
+		const auto &s = dense->shape();
+		layout.set(s[0], s[1], s[2], (s.size() > 3) ? s[3] : 1, s.size() > 3);
+		// the boundary adds up to two more values (threshold and -threshold when embedded)
+		if (!(config->bucket_levels > 0 && rankIfFewLevels(config->bucket_levels + 2))
+			&& (config->rank || dense->data().size() <= RANK_SMALL_GRID)) {
+			rankTransform();
+		}
+		// rows of cells lying entirely outside the mask are skipped when enumerating cells
+		if (masked) buildRowMask();
 	}
 
-	// load image array from file
+	// rankTransform if the grid has at most n distinct values (returns whether it has).
+	// Integer values in a short range (e.g. of uint8 images) are marked in and ranked through a table
+	// over the range, without a search per voxel; the other values (e.g. the boundary) are kept sorted.
+	bool rankIfFewLevels(size_t n){
+		auto &d = dense->data();
+		auto small_int = [](double v){ return v >= -2147483648.0 && v <= 2147483647.0 && v == std::trunc(v); };
+		double lo = DBL_MAX, hi = -DBL_MAX;
+		for (auto v : d) {
+			if (small_int(v)) {
+				lo = std::min(lo, v);
+				hi = std::max(hi, v);
+			}
+		}
+		const bool table = (lo <= hi && hi - lo < 65536);
+		vector<uint32_t> rank_of(table ? static_cast<size_t>(hi - lo) + 1 : 0, 0);
+		auto in_table = [&](double v){ return table && small_int(v) && v >= lo && v <= hi; };
+		levels.clear(); // the values not in the table
+		auto &seen = level_bits; // and their bits, so that an image of many values (e.g. float) is given up on early
+		seen.clear();
+		double last = 0;
+		bool first = true;
+		for (auto v : d) {
+			if (v == last && !first) continue;
+			last = v;
+			first = false;
+			if (in_table(v)) {
+				rank_of[static_cast<size_t>(v - lo)] = 1;
+				continue;
+			}
+			const double key = (v == 0) ? 0.0 : v; // -0.0 is the same value as 0.0
+			uint64_t bits;
+			memcpy(&bits, &key, sizeof(bits));
+			if (seen.find(bits) == seen.end()) {
+				if (levels.size() == n) {
+					levels.clear();
+					return false;
+				}
+				seen[bits] = 1;
+				levels.push_back(v);
+			}
+		}
+		sort(levels.begin(), levels.end());
+		size_t marked = 0;
+		for (auto r : rank_of) marked += r;
+		if (levels.size() + marked > n) {
+			levels.clear();
+			return false;
+		}
+		// merge the values of the table into levels, and give them their ranks
+		if (marked > 0) {
+			vector<double> others;
+			others.swap(levels);
+			levels.reserve(others.size() + marked);
+			auto o = others.begin();
+			for (size_t k = 0; k < rank_of.size(); ++k) {
+				if (rank_of[k] == 0) continue;
+				const double v = lo + static_cast<double>(k);
+				while (o != others.end() && *o < v) levels.push_back(*o++);
+				rank_of[k] = static_cast<uint32_t>(levels.size());
+				levels.push_back(v);
+			}
+			levels.insert(levels.end(), o, others.end());
+		}
+		double last_rank = -1;
+		for (auto &v : d) {
+			if (v != last || last_rank < 0) {
+				last = v;
+				last_rank = in_table(v) ? rank_of[static_cast<size_t>(v - lo)]
+					: static_cast<double>(lower_bound(levels.begin(), levels.end(), v) - levels.begin());
+			}
+			v = last_rank;
+		}
+		threshold = static_cast<double>(lower_bound(levels.begin(), levels.end(), config->threshold) - levels.begin());
+		return true;
+	}
+
+	// Replace filtration values (including the boundary) by their ranks among the distinct values.
+	// Only the order matters for the computation; values are mapped back by filtrationValue().
+	// A small grid is sorted with the positions of its values, which spares a search per voxel
+	// (at twice the memory of the values, so large grids search instead).
+	void rankTransform(){
+		auto &d = dense->data();
+		if (d.size() <= RANK_SMALL_GRID) {
+			rank_space.resize(d.size());
+			for (size_t i = 0; i < d.size(); ++i) rank_space[i] = {d[i], static_cast<uint32_t>(i)};
+			sort(rank_space.begin(), rank_space.end(),
+				[](const pair<double, uint32_t>& a, const pair<double, uint32_t>& b){ return a.first < b.first; });
+			levels.clear();
+			for (const auto &p : rank_space) {
+				if (levels.empty() || levels.back() != p.first) levels.push_back(p.first);
+				d[p.second] = static_cast<double>(levels.size() - 1);
+			}
+		} else {
+			levels.assign(d.begin(), d.end());
+			sort(levels.begin(), levels.end());
+			levels.erase(unique(levels.begin(), levels.end()), levels.end());
+			if (levels.size() > UINT32_MAX) {
+				throw std::runtime_error("Too many distinct filtration values to rank-transform");
+			}
+			for (auto &v : d) {
+				v = static_cast<double>(lower_bound(levels.begin(), levels.end(), v) - levels.begin());
+			}
+		}
+		threshold = static_cast<double>(lower_bound(levels.begin(), levels.end(), config->threshold) - levels.begin());
+	}
+
+	// for each row (Y,Z,W) of the padded grid, whether it has a voxel below the threshold
+	vector<uint8_t> denseRowsBelowThreshold() const {
+		const auto &s = dense->shape();
+		const auto &d = dense->data();
+		const size_t rows = d.size() / s[0];
+		vector<uint8_t> r(rows, 0);
+		for (size_t j = 0; j < rows; ++j) {
+			const double *v = d.data() + j * s[0];
+			for (size_t x = 0; x < s[0]; ++x) {
+				if (v[x] < threshold) { r[j] = 1; break; }
+			}
+		}
+		return r;
+	}
+
+	// original filtration value of a (possibly rank-transformed) birth or death
+	double filtrationValue(double b) const {
+		return levels.empty() ? b : levels[static_cast<size_t>(b)];
+	}
+
+	// load image array (and the mask, if any) from file
 	void loadImage(bool embedded){
-		// read file
 		cout << "Reading " << config->filename << endl;
-		switch(config->format){
+		InputArray arr;
+		bool fortran_order = true;
+		readArray(config->filename, config->format, arr, fortran_order);
+		InputArray mask;
+		bool mask_fortran_order = true;
+		if (!config->mask_filename.empty()) {
+			cout << "Reading mask " << config->mask_filename << endl;
+			const uint8_t img_dim = dim;
+			const uint32_t sx = ax, sy = ay, sz = az, sw = aw;
+			readArray(config->mask_filename, config->mask_format, mask, mask_fortran_order);
+			if (dim != img_dim || ax != sx || ay != sy || az != sz || aw != sw) {
+				throw std::runtime_error("The mask should have the same shape as the image");
+			}
+		}
+		gridFromArray(arr.data(), embedded, fortran_order, config->mask_filename.empty() ? nullptr : mask.data(), mask_fortran_order);
+		cout << "dim = " << static_cast<int>(dim) << " T-construction = " << tconstruction << " method = " << config->method << endl;
+		finalisePadding();
+		if (dim < 4){
+			cout << "x : y : z = " << img_x << " : " << img_y << " : " << img_z << endl;
+			//cout << "x : y : z = " << ax << " : " << ay << " : " << az << endl;
+		}else{
+			cout << "x : y : z : w = " << img_x << " : " << img_y << " : " << img_z << " : " << img_w << endl;
+			//cout << "x : y : z : w = " << ax << " : " << ay << " : " << az << " : " << aw << endl;
+		}
+	}
+
+	// read an array from file (sets dim and ax,ay,az,aw);
+	// binary formats are mapped, and the values are used in place unless they are compressed
+	void readArray(const string &filename, file_format format, InputArray &in, bool &fortran_order){
+		vector<double> &arr = in.values;
+		switch(format){
 			case DIPHA:
-			{
-				ifstream fin( config->filename, ios::in | ios::binary );
-				int64_t d;
-				fin.read( ( char * ) &d, sizeof( int64_t ) ); // magic number
-				assert(d == 8067171840);
-				fin.read( ( char * ) &d, sizeof( int64_t ) ); // type number
-				assert(d == 1);
-				fin.read( ( char * ) &d, sizeof( int64_t ) ); //data num
-				fin.read( ( char * ) &d, sizeof( int64_t ) ); // dim
-				dim = d;
+			try{
+				ByteReader reader = openBinary(filename, in);
+				int64_t d[4];
+				reader.read(d, sizeof(d)); // magic number, type, number of values, dimension
+				assert(d[0] == 8067171840);
+				assert(d[1] == 1);
+				dim = static_cast<uint8_t>(d[3]);
 				assert(dim < 5);
-				fin.read( ( char * ) &d, sizeof( int64_t ) );
-				ax = d;
-				if (dim>1) {
-					fin.read( ( char * ) &d, sizeof( int64_t ) );
-					ay = d;
-				}else{
-					ay = 1;
-				}
-				if (dim>2) {
-					fin.read((char *)&d, sizeof(int64_t));
-					az = d;
-				}else {
-					az = 1;
-				}
-				if (dim>3) {
-					fin.read((char *)&d, sizeof(int64_t));
-					aw = d;
-				}else {
-					aw = 1;
-				}
-				double dou;
-				vector<double> arr;
-				arr.reserve(ax*ay*az*aw);
-				while (!fin.eof()){
-					fin.read((char *)&dou, sizeof(double));
-					arr.push_back(dou);
-				}
-				fin.close();
-				gridFromArray(&arr[0], embedded, true);
+				int64_t extent[4] = {1, 1, 1, 1};
+				reader.read(extent, dim * sizeof(int64_t));
+				ax = static_cast<uint32_t>(extent[0]);
+				ay = static_cast<uint32_t>(extent[1]);
+				az = static_cast<uint32_t>(extent[2]);
+				aw = static_cast<uint32_t>(extent[3]);
+				readValues(reader, static_cast<size_t>(ax)*ay*az*aw, in);
+				fortran_order = true;
 				break;
+			} catch (const std::exception &e) {
+				throw std::runtime_error("Failed to read " + filename + ": " + e.what());
 			}
 
 			case PERSEUS:
 			{
-				ifstream reading_file;
-				reading_file.open(config->filename.c_str(), ios::in);
-				string reading_line_buffer;
-				getline(reading_file, reading_line_buffer);
-				dim = atoi(reading_line_buffer.c_str());
+				// the dimension, the extents (a line each), and the values (-1 for the threshold)
+				MappedFile file(filename);
+				const char *p = file.data(), *end = p + file.size();
+				auto header = [&](){
+					const char *line_end;
+					const char *line = p;
+					p = text_parser::nextLine(p, end, line_end);
+					while (line < line_end && text_parser::is_separator(*line)) ++line;
+					long v = 0;
+					from_chars(line, line_end, v);
+					return v;
+				};
+				dim = static_cast<uint8_t>(header());
 				assert(dim < 5);
-				getline(reading_file, reading_line_buffer);
-				ax = atoi(reading_line_buffer.c_str());
-				if (dim>1) {
-					getline(reading_file, reading_line_buffer);
-					ay = atoi(reading_line_buffer.c_str());
-				}else {
-					ay = 1;
-				}
-				if (dim>2) {
-					getline(reading_file, reading_line_buffer);
-					az = atoi(reading_line_buffer.c_str());
-				}else {
-					az = 1;
-				}
-				if (dim>3) {
-					getline(reading_file, reading_line_buffer);
-					aw = atoi(reading_line_buffer.c_str());
-				}else {
-					aw = 1;
-				}
-				vector<double> arr;
-				arr.reserve(ax*ay*az*aw);
-				while(!reading_file.eof()){
-					getline(reading_file, reading_line_buffer);
-					double dou = atof(reading_line_buffer.c_str());
-					if (dou != -1) {
-						arr.push_back(dou);
-					}else{
-						arr.push_back(config->threshold);
+				ax = static_cast<uint32_t>(header());
+				ay = (dim>1) ? static_cast<uint32_t>(header()) : 1;
+				az = (dim>2) ? static_cast<uint32_t>(header()) : 1;
+				aw = (dim>3) ? static_cast<uint32_t>(header()) : 1;
+				const unsigned num_threads = resolve_threads(config->num_threads);
+				text_parser::parseNumbers(p, end, num_threads, arr);
+				const double threshold_value = config->threshold;
+				parallel_chunks(arr.size(), num_threads, [&](unsigned, size_t b, size_t e){
+					for (size_t i = b; i < e; ++i) {
+						if (arr[i] == -1) arr[i] = threshold_value;
 					}
-				}
-				reading_file.close();
-				gridFromArray(&arr[0], embedded, true);
+				});
+				fortran_order = true;
 				break;
 			}
 
 			case CSV:
 			{
+				// a row of the image per line
 				dim = 2;
-				vector<double> arr;
-				ifstream reading_file;
-				reading_file.open(config->filename.c_str(), ios::in);
-				string line;
-				ay = 0;
-				while (getline(reading_file, line)) {
-					istringstream stream(line);
-					string field;
-					ax = 0;
-					while (getline(stream, field, ',')) {
-						arr.push_back(stod(field));
-						ax++;
-					}
-					ay++;
+				MappedFile file(filename);
+				const char *p = file.data(), *end = p + file.size();
+				const size_t rows = text_parser::parseNumbers(p, end, resolve_threads(config->num_threads), arr);
+				const char *line_end;
+				text_parser::nextLine(p, end, line_end);
+				vector<double> first_row;
+				text_parser::parseLines(p, line_end, first_row);
+				ay = static_cast<uint32_t>(rows);
+				ax = static_cast<uint32_t>(first_row.size());
+				if (static_cast<size_t>(ax) * ay != arr.size()) {
+					throw std::runtime_error("The rows of " + filename + " have different lengths");
 				}
 				az = 1;
 				aw = 1;
-				gridFromArray(&arr[0], embedded, true);
+				fortran_order = true;
 				break;
 			}
 
 			case NUMPY:
+			case NPZ:
 			{
 				vector<unsigned long> shape;
-				vector<double> arr;
-				bool fortran_order;
 				try{
-					npy::LoadArrayFromNumpy(config->filename.c_str(), shape, fortran_order, arr);
-				} catch (...) {
+					ByteReader reader = openBinary(filename, in);
+					readNumpyHeader(reader, shape, fortran_order);
+					size_t n = 1;
+					for (auto e : shape) n *= e;
+					readValues(reader, n, in);
+				} catch (const std::exception &e) {
+					cerr << "Failed to read " << filename << ": " << e.what() << endl;
 					cerr << "The data type of an numpy array should be numpy.float64." << endl;
 					exit(-2);
 				}
@@ -242,28 +466,132 @@ public:
 				}else {
 					aw = 1;
 				}
-				gridFromArray(&arr[0], embedded, fortran_order);
 				break;
 			}
 		}
-		cout << "dim = " << static_cast<int>(dim) << " T-construction = " << config->tconstruction << " method = " << config->method << endl;
-		finalisePadding();
-		if (dim < 4){
-			cout << "x : y : z = " << img_x << " : " << img_y << " : " << img_z << endl;
-			//cout << "x : y : z = " << ax << " : " << ay << " : " << az << endl;
+	}
+
+	// map a binary input file and return a reader of its content:
+	// the file itself, the .npy member of a .npz archive, or the content of a .gz file
+	static ByteReader openBinary(const string &filename, InputArray &in){
+		in.file = make_unique<MappedFile>(filename);
+		const MappedFile &file = *in.file;
+		if (isGzip(filename)) {
+			return ByteReader(file.data(), file.size(), ByteReader::GZIP);
+		}
+		if (filename.size() >= 4 && (filename.compare(filename.size() - 4, 4, ".npz") == 0 || filename.compare(filename.size() - 4, 4, ".NPZ") == 0)) {
+			const char *data;
+			size_t size;
+			ByteReader::encoding enc;
+			findNpzMember(file, data, size, enc);
+			return ByteReader(data, size, enc);
+		}
+		return ByteReader(file.data(), file.size(), ByteReader::STORED);
+	}
+
+	static bool isGzip(const string &filename){
+		return filename.size() >= 3 && (filename.compare(filename.size() - 3, 3, ".gz") == 0 || filename.compare(filename.size() - 3, 3, ".GZ") == 0);
+	}
+
+	// read n doubles: in place when they are stored (and aligned) in the mapped file, into in.values otherwise
+	static void readValues(ByteReader &reader, size_t n, InputArray &in){
+		const char *v = reader.view(n * sizeof(double));
+		if (v != nullptr && reinterpret_cast<uintptr_t>(v) % alignof(double) == 0) {
+			in.mapped = reinterpret_cast<const double*>(v);
+		} else if (v != nullptr) {
+			in.values.resize(n);
+			memcpy(in.values.data(), v, n * sizeof(double));
+		} else {
+			in.values.resize(n);
+			reader.read(in.values.data(), n * sizeof(double));
+		}
+	}
+
+	// read the header of a .npy file of float64
+	static void readNumpyHeader(ByteReader &reader, vector<unsigned long> &shape, bool &fortran_order){
+		unsigned char h[8];
+		reader.read(h, sizeof(h));
+		if (memcmp(h, npy::magic_string, npy::magic_string_length) != 0) {
+			throw std::runtime_error("not a numpy file");
+		}
+		unsigned char l[4] = {0, 0, 0, 0};
+		reader.read(l, (h[6] == 1) ? 2 : 4);
+		const size_t header_length = l[0] | (size_t(l[1]) << 8) | (size_t(l[2]) << 16) | (size_t(l[3]) << 24);
+		string header(header_length, ' ');
+		reader.read(header.data(), header_length);
+		string descr;
+		npy::parse_header(header, descr, fortran_order, shape);
+		if (descr != "<f8") throw std::runtime_error("unsupported dtype " + descr);
+	}
+
+	// restrict the grid to the bounding box of the nonzero entries of the mask (sets crop_* and ax,ay,az,aw)
+	void cropToMask(const double *mask, bool fortran_order){
+		uint32_t lo[4] = {ax, ay, az, aw};
+		uint32_t hi[4] = {0, 0, 0, 0};
+		auto expand = [&](uint32_t x, uint32_t y, uint32_t z, uint32_t w){
+			lo[0] = min(lo[0], x); hi[0] = max(hi[0], x);
+			lo[1] = min(lo[1], y); hi[1] = max(hi[1], y);
+			lo[2] = min(lo[2], z); hi[2] = max(hi[2], z);
+			lo[3] = min(lo[3], w); hi[3] = max(hi[3], w);
+		};
+		uint64_t i = 0;
+		if (fortran_order){
+			for (uint32_t w = 0; w < aw; ++w)
+				for (uint32_t z = 0; z < az; ++z)
+					for (uint32_t y = 0; y < ay; ++y)
+						for (uint32_t x = 0; x < ax; ++x)
+							if (mask[i++] != 0) expand(x, y, z, w);
 		}else{
-			cout << "x : y : z : w = " << img_x << " : " << img_y << " : " << img_z << " : " << img_w << endl;
-			//cout << "x : y : z : w = " << ax << " : " << ay << " : " << az << " : " << aw << endl;
+			for (uint32_t x = 0; x < ax; ++x)
+				for (uint32_t y = 0; y < ay; ++y)
+					for (uint32_t z = 0; z < az; ++z)
+						for (uint32_t w = 0; w < aw; ++w)
+							if (mask[i++] != 0) expand(x, y, z, w);
+		}
+		if (hi[0] < lo[0]) {
+			throw std::runtime_error("The mask contains no voxels");
 		}
+		crop_x = lo[0]; ax = hi[0] - lo[0] + 1;
+		crop_y = lo[1]; ay = hi[1] - lo[1] + 1;
+		crop_z = lo[2]; az = hi[2] - lo[2] + 1;
+		crop_w = lo[3]; aw = hi[3] - lo[3] + 1;
+		masked = true;
+	}
+
+	// strides (in elements) of a contiguous array of extents x,y,z,w
+	static array<int64_t, 4> contiguousStrides(bool fortran_order, uint32_t x, uint32_t y, uint32_t z, uint32_t w) {
+		if (fortran_order) {
+			return {1, int64_t(x), int64_t(x) * y, int64_t(x) * y * z};
+		}
+		return {int64_t(y) * z * w, int64_t(z) * w, int64_t(w), 1};
+	}
+	// the same for the extents ax,ay,az,aw
+	array<int64_t, 4> contiguousStrides(bool fortran_order) const {
+		return contiguousStrides(fortran_order, ax, ay, az, aw);
 	}
 
 	// construct volume with boundary
-	void gridFromArray(const double *arr, bool embedded, bool fortran_order){
+	// voxels where the mask (of the same shape as arr) is zero are left out of the complex,
+	// and the grid is cropped to the bounding box of the remaining ones
+	// arr may be of any arithmetic type; its values are stored as double
+	template <typename T>
+	void gridFromArray(const T *arr, bool embedded, bool fortran_order, const double *mask = nullptr, bool mask_fortran_order = true){
+		gridFromArray(arr, embedded, contiguousStrides(fortran_order), mask, mask_fortran_order);
+	}
+
+	// the same for a strided array: the element (x,y,z,w) is arr[x*strides[0] + y*strides[1] + z*strides[2] + w*strides[3]]
+	template <typename T>
+	void gridFromArray(const T *arr, bool embedded, const array<int64_t, 4> &strides, const double *mask, bool mask_fortran_order){
+		// extents of the input array
+		const uint32_t fx = ax, fy = ay, fz = az, fw = aw;
+		auto arrIndex = [&](uint32_t ox, uint32_t oy, uint32_t oz, uint32_t ow) -> int64_t {
+			return ox * strides[0] + oy * strides[1] + oz * strides[2] + ow * strides[3];
+		};
+		if (mask != nullptr) cropToMask(mask, mask_fortran_order);
 		img_x = ax;
 		img_y = ay;
 		img_z = az;
 		img_w = aw;
-		uint64_t i = 0;
 		uint32_t x_shift = 2; // total size of the boundary (left+right)
 		uint32_t y_shift = 2;
 		uint32_t z_shift = 2;
@@ -273,15 +601,17 @@ public:
 			sgn = -1;
 			x_shift = 4; // 2 inner + 2 outer
 			y_shift = 4;
-			if (az>1) z_shift = 4;
-			if (aw>1) w_shift = 4;
+			if (fz>1) z_shift = 4;
+			if (fw>1) w_shift = 4;
 		}
 		if (dim < 4){
 			// allocate with inner&outer boundary (original ax,ay,az not yet modified below)
 			const uint32_t size_x = ax + x_shift;
 			const uint32_t size_y = ay + y_shift;
 			const uint32_t size_z = az + z_shift;
-			dense = std::make_unique<NDArray<double>>(std::initializer_list<size_t>{size_x, size_y, size_z});
+			if (!dense || dense->shape() != vector<size_t>{size_x, size_y, size_z}) {
+				dense = std::make_unique<NDArray<double>>(std::initializer_list<size_t>{size_x, size_y, size_z});
+			}
 
 			const uint32_t inner_x_begin = x_shift / 2;
 			const uint32_t inner_y_begin = y_shift / 2;
@@ -292,28 +622,31 @@ public:
 
 			auto arrIndexFortran = [&](uint32_t ox, uint32_t oy, uint32_t oz) -> size_t {
 				// Fortran order: first index (x) fastest
-				return static_cast<size_t>(ox) + static_cast<size_t>(ax) * ( static_cast<size_t>(oy) + static_cast<size_t>(ay) * static_cast<size_t>(oz) );
+				return static_cast<size_t>(ox) + static_cast<size_t>(fx) * ( static_cast<size_t>(oy) + static_cast<size_t>(fy) * static_cast<size_t>(oz) );
 			};
 			auto arrIndexC = [&](uint32_t ox, uint32_t oy, uint32_t oz) -> size_t {
 				// C order: last index (z) fastest
-				return static_cast<size_t>(oz) + static_cast<size_t>(az) * ( static_cast<size_t>(oy) + static_cast<size_t>(ay) * static_cast<size_t>(ox) );
+				return static_cast<size_t>(oz) + static_cast<size_t>(fz) * ( static_cast<size_t>(oy) + static_cast<size_t>(fy) * static_cast<size_t>(ox) );
 			};
 
-			for (uint32_t x = 0; x < size_x; ++x){
-				bool inner_x = (x >= inner_x_begin && x < inner_x_end_ex);
-				uint32_t ox = x - inner_x_begin;
+			// x runs fastest in the grid
+			for (uint32_t z = 0; z < size_z; ++z){
+				bool inner_z = (z >= inner_z_begin && z < inner_z_end_ex);
+				uint32_t oz = z - inner_z_begin + crop_z;
 				for (uint32_t y = 0; y < size_y; ++y){
 					bool inner_y = (y >= inner_y_begin && y < inner_y_end_ex);
-					uint32_t oy = y - inner_y_begin;
-					for (uint32_t z = 0; z < size_z; ++z){
-						bool inner_z = (z >= inner_z_begin && z < inner_z_end_ex);
-						uint32_t oz = z - inner_z_begin;
+					uint32_t oy = y - inner_y_begin + crop_y;
+					for (uint32_t x = 0; x < size_x; ++x){
+						bool inner_x = (x >= inner_x_begin && x < inner_x_end_ex);
+						uint32_t ox = x - inner_x_begin + crop_x;
 
 						if (inner_x && inner_y && inner_z){
-							size_t idx = fortran_order
-								? arrIndexFortran(ox, oy, oz)
-								: arrIndexC(ox, oy, oz);
-							(*dense)(x, y, z) = sgn * arr[idx];
+							const int64_t idx = arrIndex(ox, oy, oz, 0);
+							if (mask != nullptr && mask[mask_fortran_order ? arrIndexFortran(ox, oy, oz) : arrIndexC(ox, oy, oz)] == 0){
+								(*dense)(x, y, z) = config->threshold; // masked out
+							}else{
+								(*dense)(x, y, z) = sgn * static_cast<double>(arr[idx]);
+							}
 						}else{
 							// outer boundary
 							if (x == 0 || x == size_x - 1 ||
@@ -333,7 +666,9 @@ public:
 			const uint32_t size_y = ay + y_shift;
 			const uint32_t size_z = az + z_shift;
 			const uint32_t size_w = aw + w_shift;
-			dense = std::make_unique<NDArray<double>>(std::initializer_list<size_t>{size_x, size_y, size_z, size_w});
+			if (!dense || dense->shape() != vector<size_t>{size_x, size_y, size_z, size_w}) {
+				dense = std::make_unique<NDArray<double>>(std::initializer_list<size_t>{size_x, size_y, size_z, size_w});
+			}
 
 			const uint32_t inner_x_begin = x_shift / 2;
 			const uint32_t inner_y_begin = y_shift / 2;
@@ -346,35 +681,38 @@ public:
 
 			auto arrIndexFortran4D = [&](uint32_t ox, uint32_t oy, uint32_t oz, uint32_t ow) -> size_t {
 				// Fortran order: first index (x) fastest
-				return static_cast<size_t>(ox) + static_cast<size_t>(ax) * (
-					static_cast<size_t>(oy) + static_cast<size_t>(ay) * (
-						static_cast<size_t>(oz) + static_cast<size_t>(az) * static_cast<size_t>(ow) ));
+				return static_cast<size_t>(ox) + static_cast<size_t>(fx) * (
+					static_cast<size_t>(oy) + static_cast<size_t>(fy) * (
+						static_cast<size_t>(oz) + static_cast<size_t>(fz) * static_cast<size_t>(ow) ));
 			};
 			auto arrIndexC4D = [&](uint32_t ox, uint32_t oy, uint32_t oz, uint32_t ow) -> size_t {
 				// C order: last index (w) fastest
-				return static_cast<size_t>(ow) + static_cast<size_t>(aw) * (
-					static_cast<size_t>(oz) + static_cast<size_t>(az) * (
-						static_cast<size_t>(oy) + static_cast<size_t>(ay) * static_cast<size_t>(ox) ));
+				return static_cast<size_t>(ow) + static_cast<size_t>(fw) * (
+					static_cast<size_t>(oz) + static_cast<size_t>(fz) * (
+						static_cast<size_t>(oy) + static_cast<size_t>(fy) * static_cast<size_t>(ox) ));
 			};
 
-			for (uint32_t x = 0; x < size_x; ++x){
-				bool inner_x = (x >= inner_x_begin && x < inner_x_end_ex);
-				uint32_t ox = x - inner_x_begin;
-				for (uint32_t y = 0; y < size_y; ++y){
-					bool inner_y = (y >= inner_y_begin && y < inner_y_end_ex);
-					uint32_t oy = y - inner_y_begin;
-					for (uint32_t z = 0; z < size_z; ++z){
-						bool inner_z = (z >= inner_z_begin && z < inner_z_end_ex);
-						uint32_t oz = z - inner_z_begin;
-						for (uint32_t w = 0; w < size_w; ++w){
-							bool inner_w = (w >= inner_w_begin && w < inner_w_end_ex);
-							uint32_t ow = w - inner_w_begin;
+			// x runs fastest in the grid
+			for (uint32_t w = 0; w < size_w; ++w){
+				bool inner_w = (w >= inner_w_begin && w < inner_w_end_ex);
+				uint32_t ow = w - inner_w_begin + crop_w;
+				for (uint32_t z = 0; z < size_z; ++z){
+					bool inner_z = (z >= inner_z_begin && z < inner_z_end_ex);
+					uint32_t oz = z - inner_z_begin + crop_z;
+					for (uint32_t y = 0; y < size_y; ++y){
+						bool inner_y = (y >= inner_y_begin && y < inner_y_end_ex);
+						uint32_t oy = y - inner_y_begin + crop_y;
+						for (uint32_t x = 0; x < size_x; ++x){
+							bool inner_x = (x >= inner_x_begin && x < inner_x_end_ex);
+							uint32_t ox = x - inner_x_begin + crop_x;
 
 							if (inner_x && inner_y && inner_z && inner_w){
-								size_t idx = fortran_order
-									? arrIndexFortran4D(ox, oy, oz, ow)
-									: arrIndexC4D(ox, oy, oz, ow);
-								(*dense)(x, y, z, w) = sgn * arr[idx];
+								const int64_t idx = arrIndex(ox, oy, oz, ow);
+								if (mask != nullptr && mask[mask_fortran_order ? arrIndexFortran4D(ox, oy, oz, ow) : arrIndexC4D(ox, oy, oz, ow)] == 0){
+									(*dense)(x, y, z, w) = config->threshold; // masked out
+								}else{
+									(*dense)(x, y, z, w) = sgn * static_cast<double>(arr[idx]);
+								}
 							}else{
 								// outer boundary
 								if (x == 0 || x == size_x - 1 ||
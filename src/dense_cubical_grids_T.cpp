@@ -21,17 +21,15 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 using namespace std;
 
 
-DenseCubicalGrids::DenseCubicalGrids(Config& _config)  {
+DenseCubicalGrids::DenseCubicalGrids(const Config& _config) : tconstruction(true) {
     config = &_config;
     threshold = config->threshold;
-    config->tconstruction = true;
 }
 
 // Explicit-shape constructor (T-construction)
-DenseCubicalGrids::DenseCubicalGrids(Config& _config, uint8_t d, uint32_t x, uint32_t y, uint32_t z, uint32_t w)  {
+DenseCubicalGrids::DenseCubicalGrids(const Config& _config, uint8_t d, uint32_t x, uint32_t y, uint32_t z, uint32_t w) : tconstruction(true) {
     config = &_config;
     threshold = config->threshold;
-    config->tconstruction = true;
     dim = d;
     ax = x; ay = y; az = z; aw = w;
     img_x = ax; img_y = ay; img_z = az; img_w = aw;
@@ -156,35 +154,52 @@ double DenseCubicalGrids::getBirth(uint32_t cx, uint32_t cy, uint32_t cz, uint32
 	return threshold; // fallback
 }
 
-// (x,y,z) of the voxel which defines the birthtime of the cube
-vector<uint32_t> DenseCubicalGrids::ParentVoxel(uint8_t _dim, Cube &c){
-	uint32_t cx = c.x();
-	uint32_t cy = c.y();
-	uint32_t cz = c.z();
-	uint32_t cw = c.w();
-
-	if (dim < 4) {
-		static const int rel[][3] = {
-			{0,0,0},{-1,0,0},{-1,-1,0},{-1,-1,-1},{-1,0,-1},{0,-1,0},{0,-1,-1},{0,0,-1}
-		};
-		for (auto &r : rel) {
-			int dx=r[0], dy=r[1], dz=r[2];
-			if (c.birth == (*dense)(cx+1+dx, cy+1+dy, cz+1+dz))
-				return {cx+dx, cy+dy, cz+dz};
+// (x,y,z,w) of the voxel which defines the birthtime of the cube:
+// the first adjacent top cell with the minimum value (w is 0 for images of dim < 4)
+array<uint32_t, 4> DenseCubicalGrids::birthVoxel(uint8_t _dim, const Cube &c){
+	uint32_t cx, cy, cz, cw;
+	layout.decode(c.index, cx, cy, cz, cw);
+	const auto &d = dense->data();
+	const uint64_t v = c.voxel();
+	// top cells (as subsets of the axes shifted by -1) in the order of preference on ties
+	static const uint8_t order[16] = {0,1,3,7,5,2,6,4, 8,9,11,15,13,10,14,12};
+	const uint8_t normal = static_cast<uint8_t>((dim > 3 ? 15 : 7) & ~cellSpan(_dim, c.m(), dim > 3));
+	uint8_t best = 0;
+	double best_value = d[v];
+	for (uint8_t k = 1; k < 16; ++k) {
+		const uint8_t s = order[k];
+		if (s & ~normal) continue;
+		const double value = d[v - layout.offset(s & 1, (s >> 1) & 1, (s >> 2) & 1, (s >> 3) & 1)];
+		if (value < best_value) {
+			best = s;
+			best_value = value;
 		}
-	} else {
-		// 4D case
-		static const int rel4d[][4] = {
-			{0,0,0,0},{-1,0,0,0},{-1,-1,0,0},{-1,-1,-1,0},
-			{-1,0,-1,0},{0,-1,0,0},{0,-1,-1,0},{0,0,-1,0},
-			{0,0,0,-1},{-1,0,0,-1},{-1,-1,0,-1},{-1,-1,-1,-1},
-			{-1,0,-1,-1},{0,-1,0,-1},{0,-1,-1,-1},{0,0,-1,-1}
-		};
-		for (const auto &r : rel4d) {
-			if (c.birth == (*dense)(cx+1+r[0], cy+1+r[1], cz+1+r[2], cw+1+r[3]))
-				return { uint32_t(cx+r[0]), uint32_t(cy+r[1]), uint32_t(cz+r[2]), uint32_t(cw+r[3]) };
+	}
+	return {cx - (best & 1u), cy - ((best >> 1) & 1u), cz - ((best >> 2) & 1u), cw - ((best >> 3) & 1u)};
+}
+
+// a cell is born at the minimum of the adjacent voxels, which lie in the rows
+// (y+1-dy, z+1-dz, w+1-dw) of the padded grid for dy,dz,dw in {0,1}
+void DenseCubicalGrids::buildRowMask(){
+	const vector<uint8_t> rows = denseRowsBelowThreshold();
+	const auto &s = dense->shape();
+	const uint32_t nw = (dim < 4) ? 1 : 2;
+	row_active.assign(static_cast<size_t>(ay) * az * aw, 0);
+	size_t i = 0;
+	for (uint32_t w = 0; w < aw; ++w) {
+		for (uint32_t z = 0; z < az; ++z) {
+			for (uint32_t y = 0; y < ay; ++y) {
+				uint8_t active = 0;
+				for (uint32_t dw = 0; dw < nw && !active; ++dw) {
+					const size_t dense_w = (dim < 4) ? 0 : w + 1 - dw;
+					for (uint32_t dz = 0; dz < 2 && !active; ++dz) {
+						for (uint32_t dy = 0; dy < 2 && !active; ++dy) {
+							active = rows[(y+1-dy) + s[1] * ((z+1-dz) + s[2] * dense_w)];
+						}
+					}
+				}
+				row_active[i++] = active;
+			}
 		}
 	}
-	cerr << "parent voxel not found!" << endl;
-	return dim < 4 ? vector<uint32_t>{0,0,0} : vector<uint32_t>{0,0,0,0};
 }
@@ -0,0 +1,62 @@
+/* dlpack.h
+
+The C ABI of DLPack tensors (https://github.com/dmlc/dlpack), as exchanged by __dlpack__
+in a PyCapsule named "dltensor". Only the parts read by the Python binding.
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+
+enum DLDeviceType : int32_t {
+	kDLCPU = 1,
+	kDLCUDAHost = 3, // pinned host memory, readable from the CPU
+};
+
+enum DLDataTypeCode : uint8_t {
+	kDLInt = 0,
+	kDLUInt = 1,
+	kDLFloat = 2,
+	kDLBool = 6,
+};
+
+struct DLDevice {
+	int32_t device_type;
+	int32_t device_id;
+};
+
+struct DLDataType {
+	uint8_t code;
+	uint8_t bits;
+	uint16_t lanes;
+};
+
+struct DLTensor {
+	void* data;
+	DLDevice device;
+	int32_t ndim;
+	DLDataType dtype;
+	int64_t* shape;
+	int64_t* strides; // in elements; NULL for a C-contiguous tensor
+	uint64_t byte_offset;
+};
+
+struct DLManagedTensor {
+	DLTensor dl_tensor;
+	void* manager_ctx;
+	void (*deleter)(DLManagedTensor* self);
+};
+
+}
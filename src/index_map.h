@@ -0,0 +1,109 @@
+/* index_map.h
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A map from uint64 keys (cell indices or column numbers) to uint64 values, in a single array
+// with open addressing (linear probing), in place of std::unordered_map, which allocates a node
+// for each entry. The key ~0 is reserved for empty slots.
+// clear() keeps the array, so that a map reused for the next dimension or the next image
+// does not allocate again once it has grown to its size.
+// find() and end() mimic the map so that the reduction reads the same with either.
+class IndexMap {
+public:
+	struct Entry {
+		uint64_t first;
+		uint64_t second;
+	};
+
+	const Entry* find(uint64_t key) const {
+		if (size_ == 0) return nullptr;
+		for (size_t i = home(key); ; i = (i + 1) & mask) {
+			if (slots[i].first == key) return &slots[i];
+			if (slots[i].first == EMPTY) return nullptr;
+		}
+	}
+	const Entry* end() const { return nullptr; }
+
+	// the value of key, inserted as 0 if it is not in the map
+	uint64_t& operator[](uint64_t key) {
+		if (4 * (size_ + 1) > 3 * slots.size()) grow();
+		size_t i = home(key);
+		while (slots[i].first != key && slots[i].first != EMPTY) i = (i + 1) & mask;
+		if (slots[i].first == EMPTY) {
+			slots[i] = Entry{key, 0};
+			++size_;
+		}
+		return slots[i].second;
+	}
+
+	// remove key (if it is in the map), moving back the entries probed past its slot
+	void erase(uint64_t key) {
+		if (size_ == 0) return;
+		size_t i = home(key);
+		while (slots[i].first != key) {
+			if (slots[i].first == EMPTY) return;
+			i = (i + 1) & mask;
+		}
+		for (size_t j = (i + 1) & mask; slots[j].first != EMPTY; j = (j + 1) & mask) {
+			// the entry at j may move to i if its home is not in (i, j] (cyclically)
+			const size_t k = home(slots[j].first);
+			if (((j - k) & mask) >= ((j - i) & mask)) {
+				slots[i] = slots[j];
+				i = j;
+			}
+		}
+		slots[i].first = EMPTY;
+		--size_;
+	}
+
+	void clear() {
+		if (size_ == 0) return;
+		for (auto &s : slots) s.first = EMPTY;
+		size_ = 0;
+	}
+
+	size_t size() const { return size_; }
+
+private:
+	static constexpr uint64_t EMPTY = ~uint64_t(0);
+	std::vector<Entry> slots;
+	size_t mask{0};
+	int shift{64};
+	size_t size_{0};
+
+	// Fibonacci hashing: the indices of neighbouring cells differ in their low bits
+	size_t home(uint64_t key) const {
+		return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> shift);
+	}
+
+	void grow() {
+		std::vector<Entry> old;
+		old.swap(slots);
+		const size_t capacity = old.empty() ? 64 : 2 * old.size();
+		slots.assign(capacity, Entry{EMPTY, 0});
+		mask = capacity - 1;
+		shift = 64;
+		for (size_t c = capacity; c > 1; c >>= 1) --shift;
+		for (const auto &e : old) {
+			if (e.first == EMPTY) continue;
+			size_t i = home(e.first);
+			while (slots[i].first != EMPTY) i = (i + 1) & mask;
+			slots[i] = e;
+		}
+	}
+};
@@ -16,112 +16,94 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <algorithm>
 #include <vector>
 #include <cstdint>
+#include <memory>
+#include <stdexcept>
 
 #include "cube.h"
 #include "dense_cubical_grids.h"
 #include "coboundary_enumerator.h"
 #include "union_find.h"
 #include "write_pairs.h"
+#include "pair_writer.h"
 #include "joint_pairs.h"
+#include "cube_sort.h"
 
 using namespace std;
 
 
 // Constructor for JointPairs
-JointPairs::JointPairs(DenseCubicalGrids* _dcg, vector<WritePairs>& _wp, Config& _config)
-    : dcg(_dcg), wp(&_wp), config(&_config) {}
+JointPairs::JointPairs(DenseCubicalGrids* _dcg, vector<WritePairs>& _wp, const Config& _config, PairWriter* _writer)
+    : wp(&_wp), writer(_writer), config(&_config), dcg(_dcg) {}
+
+JointPairs::~JointPairs() = default;
+
+void JointPairs::reset(PairWriter* _writer) {
+    writer = _writer;
+}
 
 // Enumerate all edges based on given types
 void JointPairs::enum_edges(const vector<uint8_t>& types, vector<Cube>& ctr) {
     ctr.clear();
-    // Iterate over each type (order of loops matters for performance)
-    for (const auto& m : types) {
-        for (uint32_t w = 0; w < dcg->aw; ++w) {
-            for (uint32_t z = 0; z < dcg->az; ++z) {
-                for (uint32_t y = 0; y < dcg->ay; ++y) {
-                    for (uint32_t x = 0; x < dcg->ax; ++x) {
-                        double birth = dcg->getBirth(x, y, z, w, m, 1);
-                        // If birth value is below the threshold, add to the list
-                        if (birth < config->threshold) {
-                            ctr.emplace_back(birth, x, y, z, w, m);
-                        }
-                    }
+    dcg->collectCells(types, resolve_threads(config->num_threads), ctr,
+        [this](uint8_t m, uint32_t y, uint32_t z, uint32_t w, vector<Cube>& out) {
+            for (uint32_t x = 0; x < dcg->ax; ++x) {
+                double birth = dcg->getBirth(x, y, z, w, m, 1);
+                // If birth value is below the threshold, add to the list
+                if (birth < dcg->threshold) {
+                    out.emplace_back(birth, dcg->layout.index(x, y, z, w, m));
                 }
             }
-        }
-    }
+        });
     // Sort the cubes based on birth values
-    std::sort(ctr.begin(), ctr.end(), CubeComparator());
+    sort_cubes(ctr, dcg, config, sort_space);
 }
 
 // Compute H_0 by union-find
 void JointPairs::joint_pairs_main(vector<Cube>& ctr, int current_dim) {
-    UnionFind dset(dcg);
+    if (union_find) {
+        union_find->reset(dcg);
+    } else {
+        union_find = std::make_unique<UnionFind>(dcg);
+    }
+    UnionFind &dset = *union_find;
     uint64_t u, v = 0;
-    double min_birth = config->threshold;
+    double min_birth = dcg->threshold;
     uint64_t min_idx = 0;
 
-    auto decode = [&](uint64_t idx, uint32_t& x, uint32_t& y, uint32_t& z, uint32_t& w) {
-        uint64_t t = idx;
-        x = t % dcg->ax; t /= dcg->ax;
-        y = t % dcg->ay; t /= dcg->ay;
-        z = t % dcg->az;
-        w = t / dcg->az;
-    };
+    // Cube::index of the vertex at the given union-find node
+    auto vertex = [&](uint64_t idx) { return dcg->layout.origin + idx; };
+
+    // The union-find structure is indexed by the voxel offset in the padded grid,
+    // so that the end points of an edge are obtained without decoding its coordinates.
+    uint64_t delta[13];
+    if (dcg->dim == 4) {
+        // 4D neighbor offsets for edge types
+        static const int8_t dx4d[4] = {1, 0, 0, 0};  // x, y, z, w edges
+        static const int8_t dy4d[4] = {0, 1, 0, 0};
+        static const int8_t dz4d[4] = {0, 0, 1, 0};
+        static const int8_t dw4d[4] = {0, 0, 0, 1};
+        for (int m = 0; m < 4; ++m) {
+            delta[m] = dcg->layout.offset(dx4d[m], dy4d[m], dz4d[m], dw4d[m]);
+        }
+    } else {
+        // 13 neighbor patterns used in V/T constructions (3D); for 1D/2D
+        // only the relevant prefixes are referenced by m
+        static const int8_t dx[13]={1,0,0, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1};
+        static const int8_t dy[13]={0,1,0, 1,-1,-1, 1,-1, 0, 1,-1, 0, 1};
+        static const int8_t dz[13]={0,0,1, 0, 0, 1, 1, 1, 1, 1,-1,-1,-1};
+        for (int m = 0; m < 13; ++m) {
+            delta[m] = dcg->layout.offset(dx[m], dy[m], dz[m], 0);
+        }
+    }
+    const int num_types = (dcg->dim == 4) ? 4 : 13;
+
     // Process cubes in reverse order (starting from the highest birth time)
     for (auto e = ctr.rbegin(); e != ctr.rend(); ++e) {
-        // Calculate the linear index for the union-find structure
-        uint64_t uind, vind;
-
-        // source coordinates
-        const uint32_t ex = e->x();
-        const uint32_t ey = e->y();
-        const uint32_t ez = e->z();
-        const uint32_t ew = (dcg->dim >= 4) ? e->w() : 0u;
-
-        if (dcg->dim == 4) {
-            // 4D indexing
-            uind = ex + dcg->ax * ey + dcg->axy * ez + dcg->axyz * ew;
-
-            // 4D neighbor offsets for edge types
-            static const int8_t dx4d[4] = {1, 0, 0, 0};  // x, y, z, w edges
-            static const int8_t dy4d[4] = {0, 1, 0, 0};
-            static const int8_t dz4d[4] = {0, 0, 1, 0};
-            static const int8_t dw4d[4] = {0, 0, 0, 1};
-
-            const int m = e->m();
-            if (m < 0 || m >= 4) std::exit(-1);
-
-            // neighbor coordinates with strict per-axis bounds check
-            const int64_t nx = static_cast<int64_t>(ex) + dx4d[m];
-            const int64_t ny = static_cast<int64_t>(ey) + dy4d[m];
-            const int64_t nz = static_cast<int64_t>(ez) + dz4d[m];
-            const int64_t nw = static_cast<int64_t>(ew) + dw4d[m];
-
-            vind = static_cast<uint64_t>(nx)
-                 + static_cast<uint64_t>(dcg->ax) * static_cast<uint64_t>(ny)
-                 + static_cast<uint64_t>(dcg->axy) * static_cast<uint64_t>(nz)
-                 + static_cast<uint64_t>(dcg->axyz) * static_cast<uint64_t>(nw);
-        } else {
-            // up to 3D indexing (handles 1D/2D/3D uniformly with az,aw possibly 1)
-            uind = ex + dcg->ax * ey + dcg->axy * ez;
-
-            // 13 neighbor patterns used in V/T constructions (3D); for 1D/2D
-            // only the relevant prefixes are referenced by m
-            static const int8_t dx[13]={1,0,0, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1};
-            static const int8_t dy[13]={0,1,0, 1,-1,-1, 1,-1, 0, 1,-1, 0, 1};
-            static const int8_t dz[13]={0,0,1, 0, 0, 1, 1, 1, 1, 1,-1,-1,-1};
-            const int m = e->m();
-            if (m < 0 || m >= 13) std::exit(-1);
-
-            const int64_t nx = static_cast<int64_t>(ex) + dx[m];
-            const int64_t ny = static_cast<int64_t>(ey) + dy[m];
-            const int64_t nz = static_cast<int64_t>(ez) + dz[m];
-
-            vind = static_cast<uint64_t>(nx)
-                 + static_cast<uint64_t>(dcg->ax) * static_cast<uint64_t>(ny)
-                 + static_cast<uint64_t>(dcg->axy) * static_cast<uint64_t>(nz);
-        }
+        // linear indices of the two end points for the union-find structure
+        const int m = e->m();
+        if (m >= num_types) throw std::logic_error("joint_pairs_main: invalid edge type");
+        const uint64_t uind = e->voxel() - dcg->layout.origin;
+        const uint64_t vind = uind + delta[m];
 
         u = dset.find(uind);
         v = dset.find(vind);
@@ -129,21 +111,22 @@ void JointPairs::joint_pairs_main(vector<Cube>& ctr, int current_dim) {
 
         if (u != v) {  // If u and v are not already connected
             double birth;
-            uint64_t birth_ind, death_ind;
+            // the younger root and the later end point of the edge define the birth and the death
+            // (their locations are exchanged under Alexander duality when the pairs are written)
+            uint64_t birth_ind;
+            const uint64_t death_ind = dset.birthtime[uind] > dset.birthtime[vind] ? uind : vind;
             //cout << dset.birthtime[u] << ", " << dset.birthtime[v] << endl;
             // Determine which component is younger and will be merged
             if (dset.birthtime[u] >= dset.birthtime[v]) {
                 birth = dset.birthtime[u];
-                birth_ind = current_dim == 0 ? u : (dset.birthtime[uind] > dset.birthtime[vind] ? uind : vind);
-                death_ind = current_dim == 0 ? (dset.birthtime[uind] > dset.birthtime[vind] ? uind : vind) : u;
+                birth_ind = u;
                 if (dset.birthtime[v] < min_birth) {
                     min_birth = dset.birthtime[v];
                     min_idx = v;
                 }
             } else {
                 birth = dset.birthtime[v];
-                birth_ind = current_dim == 0 ? v : (dset.birthtime[uind] > dset.birthtime[vind] ? uind : vind);
-                death_ind = current_dim == 0 ? (dset.birthtime[uind] > dset.birthtime[vind] ? uind : vind) : v;
+                birth_ind = v;
                 if (dset.birthtime[u] < min_birth) {
                     min_birth = dset.birthtime[u];
                     min_idx = u;
@@ -156,19 +139,15 @@ void JointPairs::joint_pairs_main(vector<Cube>& ctr, int current_dim) {
 
             // Record the birth-death pair if they are not equal
             if (birth != death) {
-                uint32_t bx, by, bz, bw, dx, dy, dz, dw;
-                decode(birth_ind, bx, by, bz, bw);
-                decode(death_ind, dx, dy, dz, dw);
-
-                if (config->tconstruction) {
-                    wp->emplace_back(current_dim,
-                        Cube(birth, bx, by, bz, bw, 0),
-                        Cube(death, dx, dy, dz, dw, 0),
-                        dcg, config->print);
+                const Cube birthC(birth, vertex(birth_ind));
+                if (dcg->tconstruction && current_dim == 0) {
+                    // the component is born at a vertex and killed by the edge
+                    wp->emplace_back(current_dim, birthC, 0, *e, 1);
                 } else {
-                    wp->emplace_back(current_dim, birth, death,
-                        bx, by, bz, bw, dx, dy, dz, dw, config->print);
+                    // the edge is born with its later end point
+                    wp->emplace_back(current_dim, birthC, 0, Cube(death, vertex(death_ind)), 0);
                 }
+                if (writer) writer->writeIfFull(*wp);
             }
             e->index = NONE;  // Mark edge as processed
         }
@@ -176,9 +155,7 @@ void JointPairs::joint_pairs_main(vector<Cube>& ctr, int current_dim) {
 
     // Handle the base point component for H_0
     if (current_dim == 0) {
-        uint32_t bx, by, bz, bw, dx, dy, dz, dw;
-        decode(min_idx, bx, by, bz, bw);
-        wp->emplace_back(current_dim, min_birth, dcg->threshold, bx, by, bz, bw, 0, 0, 0, 0, config->print);
+        wp->emplace_back(current_dim, Cube(min_birth, vertex(min_idx)), 0);
     }
 
     // Remove unnecessary edges and optimize storage
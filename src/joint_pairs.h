@@ -15,21 +15,32 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <vector>
 #include <cstdint>
+#include <memory>
 #include "config.h"
 #include "cube.h"          // Needed for std::vector<Cube>
 #include "write_pairs.h"   // Needed for std::vector<WritePairs>
+#include "cube_sort.h"     // Needed for CubeSortSpace
 
 class DenseCubicalGrids;
+class PairWriter;
+class UnionFind;
 
 class JointPairs {
 private:
     std::vector<WritePairs>* wp;  // Pointer to vector of WritePairs for storing results
-    Config* config;               // Pointer to configuration settings
+    PairWriter* writer;           // Pairs are flushed to it as they accumulate (if not null)
+    const Config* config;         // Pointer to configuration settings
     DenseCubicalGrids* dcg;        // Pointer to the dense cubical grids object
+    std::unique_ptr<UnionFind> union_find; // Kept for the next grid
+    CubeSortSpace sort_space;     // Scratch space of the sort, kept for the next grid
 
 public:
     // Constructor for initializing JointPairs
-    JointPairs(DenseCubicalGrids* _dcg, std::vector<WritePairs>& _wp, Config& _config);
+    JointPairs(DenseCubicalGrids* _dcg, std::vector<WritePairs>& _wp, const Config& _config, PairWriter* _writer = nullptr);
+    ~JointPairs();
+
+    // Start over with the next grid (filled into the same DenseCubicalGrids), writing to _writer
+    void reset(PairWriter* _writer);
 
     // Method to enumerate all edges based on provided types
     void enum_edges(const std::vector<uint8_t>& types, std::vector<Cube>& ctr);
@@ -0,0 +1,83 @@
+/* mapped_file.h
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CRIPSER_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of the whole content of a file.
+// The file is memory-mapped where mmap is available, and read in one bulk read otherwise.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& filename) {
+#ifdef CRIPSER_HAS_MMAP
+		const int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("Failed to open " + filename);
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw std::runtime_error("Failed to open " + filename);
+		}
+		size_ = static_cast<size_t>(st.st_size);
+		if (size_ > 0) {
+			void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				throw std::runtime_error("Failed to map " + filename);
+			}
+			::madvise(p, size_, MADV_SEQUENTIAL);
+			data_ = static_cast<const char*>(p);
+		}
+		::close(fd);
+#else
+		std::ifstream fin(filename, std::ios::in | std::ios::binary | std::ios::ate);
+		if (!fin) throw std::runtime_error("Failed to open " + filename);
+		buffer_.resize(static_cast<size_t>(fin.tellg()));
+		fin.seekg(0);
+		fin.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+		data_ = buffer_.data();
+		size_ = buffer_.size();
+#endif
+	}
+
+	~MappedFile() {
+#ifdef CRIPSER_HAS_MMAP
+		if (data_ != nullptr) ::munmap(const_cast<char*>(data_), size_);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	const char* data_{nullptr};
+	size_t size_{0};
+#ifndef CRIPSER_HAS_MMAP
+	std::vector<char> buffer_;
+#endif
+};
@@ -0,0 +1,397 @@
+/* pair_writer.cpp
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <charconv>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "dense_cubical_grids.h"
+#include "write_pairs.h"
+#include "pair_writer.h"
+
+using namespace std;
+
+namespace {
+
+constexpr int64_t DIPHA_MAGIC = 8067171840;
+constexpr int64_t DIPHA_PERSISTENCE_DIAGRAM = 2;
+
+// .npy header padded to the given length (a multiple of 64; 0 for the shortest)
+// so that it can be rewritten in place as the number of rows grows
+string npyHeader(const string& descr, uint64_t rows, size_t ncols, size_t length) {
+	string dict = "{'descr': " + descr + ", 'fortran_order': False, 'shape': (" + to_string(rows) + ", "
+		+ (ncols > 0 ? to_string(ncols) : string()) + "), }";
+	const size_t prefix = 10; // magic string, version and header length
+	if (length == 0) length = (prefix + dict.size() + 1 + 63) / 64 * 64;
+	dict.append(length - prefix - dict.size() - 1, ' ');
+	dict.push_back('\n');
+	string h("\x93NUMPY\x01\x00", 8);
+	const uint16_t len = static_cast<uint16_t>(dict.size());
+	h.push_back(static_cast<char>(len & 0xff));
+	h.push_back(static_cast<char>(len >> 8));
+	return h + dict;
+}
+
+// appends numbers to a line buffer large enough for a pair
+class LineBuilder {
+public:
+	char buf[512];
+	char* p = buf;
+#if defined(__cpp_lib_to_chars)
+	void put(double v) { p = to_chars(p, buf + sizeof(buf), v).ptr; }
+#else
+	// no floating-point std::to_chars (libc++ before macOS 13.3):
+	// the shortest of %.15g, %.16g and %.17g that reads back as v
+	void put(double v) {
+		int n = 0;
+		for (int precision = 15; precision <= 17; ++precision) {
+			n = snprintf(p, buf + sizeof(buf) - p, "%.*g", precision, v);
+			if (strtod(p, nullptr) == v) break;
+		}
+		p += n;
+	}
+#endif
+	void put(int64_t v) { p = to_chars(p, buf + sizeof(buf), v).ptr; }
+	void put(const char* s) { while (*s) *p++ = *s++; }
+	void put(char c) { *p++ = c; }
+	void flushTo(string& out) { out.append(buf, p); p = buf; }
+};
+
+} // namespace
+
+void formatCSV(const ResolvedPair* pairs, size_t n, bool location, bool has_w, string& out) {
+	LineBuilder line;
+	for (size_t i = 0; i < n; ++i) {
+		const ResolvedPair& pair = pairs[i];
+		line.put(static_cast<int64_t>(pair.dim)); line.put(',');
+		line.put(pair.birth); line.put(',');
+		line.put(pair.death);
+		if (location) {
+			line.put(','); line.put(pair.birth_x); line.put(','); line.put(pair.birth_y); line.put(','); line.put(pair.birth_z);
+			if (has_w) { line.put(','); line.put(pair.birth_w); }
+			line.put(','); line.put(pair.death_x); line.put(','); line.put(pair.death_y); line.put(','); line.put(pair.death_z);
+			if (has_w) { line.put(','); line.put(pair.death_w); }
+		}
+		line.put('\n');
+		line.flushTo(out);
+	}
+}
+
+void formatPrint(const ResolvedPair* pairs, size_t n, bool has_w, string& out) {
+	LineBuilder line;
+	for (size_t i = 0; i < n; ++i) {
+		const ResolvedPair& pair = pairs[i];
+		line.put('['); line.put(pair.birth); line.put(','); line.put(pair.death);
+		line.put(") birth loc. (");
+		line.put(pair.birth_x); line.put(','); line.put(pair.birth_y); line.put(','); line.put(pair.birth_z);
+		if (has_w) { line.put(','); line.put(pair.birth_w); }
+		line.put("),  death loc. (");
+		line.put(pair.death_x); line.put(','); line.put(pair.death_y); line.put(','); line.put(pair.death_z);
+		if (has_w) { line.put(','); line.put(pair.death_w); }
+		line.put(")\n");
+		line.flushTo(out);
+	}
+}
+
+template <typename F>
+void PairWriter::writeText(ostream& os, unsigned num_threads, F&& format) {
+	vector<string> parts(num_threads);
+	const unsigned nt = parallel_chunks(buf.size(), num_threads, [&](unsigned t, size_t b, size_t e) {
+		parts[t].reserve((e - b) * 64);
+		format(buf.data() + b, e - b, parts[t]);
+	});
+	for (unsigned t = 0; t < nt; ++t) {
+		os.write(parts[t].data(), static_cast<streamsize>(parts[t].size()));
+	}
+}
+
+PairWriter::PairWriter(DenseCubicalGrids* _dcg, const Config& _config)
+	: dcg(_dcg), config(&_config) {
+	const string &filename = config->output_filename;
+	const size_t pos = filename.find_last_of('.');
+	const string ext = (pos == string::npos) ? "" : filename.substr(pos);
+	if (ext == ".csv") {
+		kind = OUT_CSV;
+	} else if (ext == ".npy") {
+		kind = OUT_NPY;
+	} else if (filename != "none") {
+		kind = OUT_DIPHA;
+	} else {
+		kind = OUT_NONE;
+	}
+	// dim,birth,death,(x1,y1,z1[,w1]),(x2,y2,z2[,w2]); the locations are dropped with --location none
+	ncols = (config->location == LOC_NONE) ? 3 : ((dcg->dim < 4) ? 9 : 11);
+	if (kind == OUT_NPY) setNpyLayout();
+	// DIPHA holds only the values
+	location = (ncols > 3) && (kind == OUT_CSV || kind == OUT_NPY || config->print);
+	if (kind == OUT_NONE) return;
+
+	tmp_filename = filename + ".tmp";
+	out.open(tmp_filename.c_str(), (kind == OUT_CSV) ? ios::out : (ios::out | ios::binary));
+	if (!out) {
+		throw runtime_error("Failed to open output file");
+	}
+	writeHeader();
+}
+
+PairWriter::PairWriter(DenseCubicalGrids* _dcg, const Config& _config, RowBuffer* _rows,
+		function<void(size_t, size_t)> _on_rows)
+	: dcg(_dcg), config(&_config), kind(OUT_ROWS), rows(_rows), on_rows(std::move(_on_rows)) {
+	ncols = rows->columns();
+	location = (ncols > 3);
+}
+
+PairWriter::~PairWriter() {
+	// not closed: the computation failed
+	if (out.is_open()) {
+		try {
+			keepPartial();
+		} catch (...) {
+		}
+	}
+}
+
+// close the file and move it to <output>.partial
+void PairWriter::keepPartial() {
+	out.close();
+	const string partial = partialFilename(config->output_filename);
+	remove(partial.c_str());
+	rename(tmp_filename.c_str(), partial.c_str());
+}
+
+void PairWriter::setRows(RowBuffer* _rows, function<void(size_t, size_t)> _on_rows) {
+	rows = _rows;
+	on_rows = std::move(_on_rows);
+	ncols = rows->columns();
+	location = (ncols > 3);
+	written = 0;
+}
+
+void PairWriter::setNpyLayout() {
+	structured = (config->npy != NPY_MATRIX);
+	if (!structured) {
+		npy_descr = "'<f8'";
+	} else {
+		value_bytes = (config->npy == NPY_STRUCTURED32) ? 4 : 8;
+		// coordinates in the input image fit in int16 unless an axis is longer than that
+		const uint64_t extent = max({uint64_t(dcg->crop_x) + dcg->img_x, uint64_t(dcg->crop_y) + dcg->img_y,
+			uint64_t(dcg->crop_z) + dcg->img_z, uint64_t(dcg->crop_w) + dcg->img_w});
+		coord_bytes = (extent <= INT16_MAX) ? 2 : 4;
+		const string value = (value_bytes == 4) ? "'<f4'" : "'<f8'";
+		const string coord = (coord_bytes == 2) ? "'<i2'" : "'<i4'";
+		npy_descr = "[('dim', '|u1'), ('birth', " + value + "), ('death', " + value + ")";
+		if (ncols > 3) {
+			const char* axes = (dcg->dim < 4) ? "xyz" : "xyzw";
+			for (const char* n : {"1", "2"}) {
+				for (const char* a = axes; *a; ++a) {
+					npy_descr += ", ('" + string(1, *a) + n + "', " + coord + ")";
+				}
+			}
+		}
+		npy_descr += "]";
+	}
+	record_bytes = structured ? 1 + 2 * value_bytes + (ncols - 3) * coord_bytes : ncols * sizeof(double);
+	npy_header_length = npyHeader(npy_descr, UINT64_MAX, structured ? 0 : ncols, 0).size();
+}
+
+// pack the pair into a record of the structured .npy layout
+void PairWriter::packRecord(const ResolvedPair& pair, char* rec) const {
+	*rec++ = static_cast<char>(pair.dim);
+	auto put_value = [&](double v) {
+		if (value_bytes == 4) {
+			const float f = static_cast<float>(v);
+			memcpy(rec, &f, 4);
+		} else {
+			memcpy(rec, &v, 8);
+		}
+		rec += value_bytes;
+	};
+	auto put_coord = [&](int64_t v) {
+		if (coord_bytes == 2) {
+			const int16_t c = static_cast<int16_t>(v);
+			memcpy(rec, &c, 2);
+		} else {
+			const int32_t c = static_cast<int32_t>(v);
+			memcpy(rec, &c, 4);
+		}
+		rec += coord_bytes;
+	};
+	put_value(pair.birth);
+	put_value(pair.death);
+	if (ncols == 3) return;
+	const bool has_w = (dcg->dim >= 4);
+	put_coord(pair.birth_x); put_coord(pair.birth_y); put_coord(pair.birth_z);
+	if (has_w) put_coord(pair.birth_w);
+	put_coord(pair.death_x); put_coord(pair.death_y); put_coord(pair.death_z);
+	if (has_w) put_coord(pair.death_w);
+}
+
+// the pair as a row of ncols doubles
+void PairWriter::putRow(const ResolvedPair& pair, double* row) const {
+	const bool has_w = (dcg->dim >= 4);
+	size_t k = 0;
+	row[k++] = static_cast<double>(pair.dim);
+	row[k++] = pair.birth;
+	row[k++] = pair.death;
+	if (ncols == 3) return;
+	row[k++] = static_cast<double>(pair.birth_x);
+	row[k++] = static_cast<double>(pair.birth_y);
+	row[k++] = static_cast<double>(pair.birth_z);
+	if (has_w) row[k++] = static_cast<double>(pair.birth_w);
+	row[k++] = static_cast<double>(pair.death_x);
+	row[k++] = static_cast<double>(pair.death_y);
+	row[k++] = static_cast<double>(pair.death_z);
+	if (has_w) row[k++] = static_cast<double>(pair.death_w);
+}
+
+// write (or rewrite) the header with the current number of pairs
+void PairWriter::writeHeader() {
+	if (kind == OUT_NPY) {
+		const string h = npyHeader(npy_descr, written, structured ? 0 : ncols, npy_header_length);
+		out.write(h.data(), static_cast<streamsize>(h.size()));
+	} else if (kind == OUT_DIPHA) {
+		const int64_t header[3] = {DIPHA_MAGIC, DIPHA_PERSISTENCE_DIAGRAM, static_cast<int64_t>(written)};
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	}
+}
+
+void PairWriter::write(vector<WritePairs>& wp) {
+	const bool has_w = (dcg->dim >= 4);
+	const unsigned num_threads = resolve_threads(config->num_threads);
+	const size_t first_row = (kind == OUT_ROWS) ? rows->rows() : 0;
+	vector<double> row(ncols);
+	for (size_t b = 0; b < wp.size(); b += CHUNK) {
+		const size_t n = min(CHUNK, wp.size() - b);
+		buf.resize(n);
+		resolvePairs(wp.data() + b, n, dcg, location, buf.data(), num_threads);
+		if (config->print) {
+			writeText(cout, num_threads, [has_w](const ResolvedPair* p, size_t m, string& s) {
+				formatPrint(p, m, has_w, s);
+			});
+			cout.flush();
+		}
+		switch (kind) {
+			case OUT_CSV:
+				writeText(out, num_threads, [this, has_w](const ResolvedPair* p, size_t m, string& s) {
+					formatCSV(p, m, ncols > 3, has_w, s);
+				});
+				break;
+			case OUT_NPY:
+				if (structured) {
+					records.resize(n * record_bytes);
+					parallel_chunks(n, num_threads, [&](unsigned, size_t lo, size_t hi) {
+						for (size_t i = lo; i < hi; ++i) packRecord(buf[i], records.data() + i * record_bytes);
+					});
+					out.write(records.data(), static_cast<streamsize>(records.size()));
+					break;
+				}
+				for (const auto& pair : buf) {
+					putRow(pair, row.data());
+					out.write(reinterpret_cast<const char*>(row.data()), static_cast<streamsize>(ncols * sizeof(double)));
+				}
+				break;
+			case OUT_DIPHA:
+				for (const auto& pair : buf) {
+					const int64_t dim = pair.dim;
+					out.write(reinterpret_cast<const char*>(&dim), sizeof(int64_t));
+					out.write(reinterpret_cast<const char*>(&pair.birth), sizeof(double));
+					out.write(reinterpret_cast<const char*>(&pair.death), sizeof(double));
+				}
+				break;
+			case OUT_ROWS: {
+				double* dst = rows->append(n);
+				parallel_chunks(n, num_threads, [&](unsigned, size_t lo, size_t hi) {
+					for (size_t i = lo; i < hi; ++i) putRow(buf[i], dst + i * ncols);
+				});
+				break;
+			}
+			case OUT_NONE:
+				break;
+		}
+		written += n;
+	}
+	const size_t n = wp.size();
+	wp.clear();
+	if (kind == OUT_ROWS && on_rows && n > 0) on_rows(first_row, n);
+	if (kind == OUT_NONE || kind == OUT_ROWS) return;
+	// keep the file readable up to this point
+	if (kind != OUT_CSV) {
+		const auto end = out.tellp();
+		out.seekp(0);
+		writeHeader();
+		out.seekp(end);
+	}
+	out.flush();
+	if (!out) {
+		throw runtime_error("Failed to write output file");
+	}
+}
+
+void PairWriter::close() {
+	if (!out.is_open()) return;
+	out.close();
+	if (!out) {
+		keepPartial();
+		throw runtime_error("Failed to write output file");
+	}
+	// rename does not replace an existing file on Windows
+	const string &filename = config->output_filename;
+	remove(filename.c_str());
+	if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		throw runtime_error("Failed to rename " + tmp_filename + " to the output file (the pairs are kept in " + tmp_filename + ")");
+	}
+}
+
+double* RowBuffer::append(size_t n) {
+	if (size_ + n > capacity_) {
+		// doubling, so that the rows are moved (if at all) a bounded number of times
+		const size_t capacity = max({size_ + n, 2 * capacity_, size_t(1024)});
+		void* p = realloc(data_, capacity * ncols * sizeof(double));
+		if (p == nullptr) throw bad_alloc();
+		data_ = static_cast<double*>(p);
+		capacity_ = capacity;
+	}
+	double* dst = data_ + size_ * ncols;
+	size_ += n;
+	return dst;
+}
+
+void RowBuffer::reserve(size_t n) {
+	if (n <= capacity_) return;
+	void* p = realloc(data_, n * ncols * sizeof(double));
+	if (p == nullptr) throw bad_alloc();
+	data_ = static_cast<double*>(p);
+	capacity_ = n;
+}
+
+double* RowBuffer::release() {
+	double* p = data_;
+	if (size_ == 0) {
+		free(p);
+		p = nullptr;
+	} else if (size_ < capacity_) {
+		// shrinking in place; the original block is kept if it cannot be
+		if (void* q = realloc(p, size_ * ncols * sizeof(double))) p = static_cast<double*>(q);
+	}
+	data_ = nullptr;
+	size_ = capacity_ = 0;
+	return p;
+}
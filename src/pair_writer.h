@@ -0,0 +1,130 @@
+/* pair_writer.h
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "write_pairs.h"
+
+// Append the pairs as CSV lines (dim,birth,death[,creator[,destroyer]]) to out;
+// values are written in the shortest form that reads back to the same double
+void formatCSV(const ResolvedPair* pairs, size_t n, bool location, bool has_w, std::string& out);
+// Append the pairs in the format of --print to out
+void formatPrint(const ResolvedPair* pairs, size_t n, bool has_w, std::string& out);
+
+// Rows of doubles appended to a buffer that grows as the pairs are found (the result of the Python module).
+// The buffer is allocated by malloc and grown by realloc, which remaps large blocks instead of copying them,
+// and can be handed over by release() to an owner that frees it by free().
+class RowBuffer
+{
+public:
+	explicit RowBuffer(size_t _ncols) : ncols(_ncols) {}
+	~RowBuffer() { std::free(data_); }
+	RowBuffer(RowBuffer&& other) noexcept
+		: ncols(other.ncols), data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+		other.data_ = nullptr;
+		other.size_ = other.capacity_ = 0;
+	}
+	RowBuffer(const RowBuffer&) = delete;
+	RowBuffer& operator=(const RowBuffer&) = delete;
+
+	// space for n more rows
+	double* append(size_t n);
+	// room for n rows in all, so that appending up to them does not move the rows
+	void reserve(size_t n);
+	void clear() { size_ = 0; }
+	double* data() const { return data_; }
+	size_t rows() const { return size_; }
+	size_t columns() const { return ncols; }
+	// the buffer trimmed to the rows (nullptr if there are none); the RowBuffer is left empty
+	double* release();
+
+private:
+	size_t ncols;
+	double* data_{nullptr};
+	size_t size_{0};
+	size_t capacity_{0}; // in rows
+};
+
+// Writes the pairs to config.output_filename (.csv, .npy, or DIPHA otherwise) while they are computed.
+// The .npy output is a float64 matrix or an array of packed records (see npy_layout).
+// The pairs accumulated in a vector are resolved and appended by write(), which empties the vector,
+// so that at most CHUNK pairs are held in memory.
+// The file is written as <output>.tmp and renamed to the output by close(), so that a previous output
+// is not replaced by a partial one. A writer destroyed without close() (the computation failed) keeps
+// the pairs written so far as <output>.partial.
+// The .npy header and the DIPHA point count are updated on every write, so that the .tmp (or .partial)
+// file holds the pairs found so far even if the process is killed.
+class PairWriter
+{
+public:
+	static constexpr size_t CHUNK = size_t(1) << 20;
+
+	PairWriter(DenseCubicalGrids* _dcg, const Config& _config);
+	// append the pairs as rows (dim, birth, death[, creator, destroyer]) to rows instead;
+	// rows.columns() is 3, or 9 (11 in 4D) with the locations.
+	// on_rows (if given) is called with the range [first, first + n) of the rows appended by each write.
+	PairWriter(DenseCubicalGrids* _dcg, const Config& _config, RowBuffer* _rows,
+		std::function<void(size_t first, size_t n)> _on_rows = nullptr);
+	~PairWriter();
+
+	// append the rows of the following writes to _rows (a writer of rows, kept for the next grid)
+	void setRows(RowBuffer* _rows, std::function<void(size_t first, size_t n)> _on_rows = nullptr);
+
+	// resolve, print and append the pairs in wp, and empty it
+	void write(std::vector<WritePairs>& wp);
+	// write once CHUNK pairs have accumulated
+	void writeIfFull(std::vector<WritePairs>& wp) {
+		if (wp.size() >= CHUNK) write(wp);
+	}
+	// finish the file and rename it to the output
+	void close();
+	// where a writer to output keeps the pairs written before a failure
+	static std::string partialFilename(const std::string& output) { return output + ".partial"; }
+	// number of pairs written so far
+	uint64_t count() const { return written; }
+
+private:
+	enum output_kind { OUT_NONE, OUT_CSV, OUT_NPY, OUT_DIPHA, OUT_ROWS };
+	DenseCubicalGrids* dcg;
+	const Config* config;
+	output_kind kind;
+	bool location;   // whether the locations are resolved
+	size_t ncols;    // fields of the .npy output
+	// .npy layout
+	bool structured{false};
+	size_t value_bytes{8}, coord_bytes{4}, record_bytes{0};
+	std::string npy_descr;
+	size_t npy_header_length{0};
+	std::vector<char> records;
+	uint64_t written{0};
+	std::ofstream out;
+	std::string tmp_filename; // the file being written
+	std::vector<ResolvedPair> buf;
+	RowBuffer* rows{nullptr};
+	std::function<void(size_t, size_t)> on_rows;
+
+	void setNpyLayout();
+	void keepPartial();
+	void putRow(const ResolvedPair& pair, double* row) const;
+	void packRecord(const ResolvedPair& pair, char* rec) const;
+	void writeHeader();
+	// format the pairs in buf by parts on the worker threads, and write the parts in order to os
+	template <typename F>
+	void writeText(std::ostream& os, unsigned num_threads, F&& format);
+};
@@ -0,0 +1,45 @@
+/* parallel.h
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// number of worker threads for the setting n (0: all hardware threads)
+inline unsigned resolve_threads(int n) {
+	if (n > 0) return static_cast<unsigned>(n);
+	const unsigned hw = std::thread::hardware_concurrency();
+	return hw > 0 ? hw : 1;
+}
+
+// split [0,n) into at most num_threads contiguous chunks (in order) and call f(t, begin, end)
+// for the t-th chunk on its own thread; returns the number of chunks
+template <typename F>
+unsigned parallel_chunks(size_t n, unsigned num_threads, F&& f) {
+	const unsigned nt = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(num_threads, n)));
+	if (nt == 1) {
+		f(0u, size_t(0), n);
+		return 1;
+	}
+	std::vector<std::thread> workers;
+	workers.reserve(nt - 1);
+	for (unsigned t = 1; t < nt; ++t) {
+		workers.emplace_back([&f, t, n, nt]() { f(t, n * t / nt, n * (t + 1) / nt); });
+	}
+	f(0u, size_t(0), n / nt);
+	for (auto& w : workers) w.join();
+	return nt;
+}
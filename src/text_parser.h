@@ -0,0 +1,165 @@
+/* text_parser.h
+
+This file is part of CubicalRipser
+Copyright 2017-2018 Takeki Sudo and Kazushi Ahara.
+Modified by Shizuo Kaji
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#if !defined(__cpp_lib_to_chars)
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#if !defined(_WIN32)
+#include <locale.h>
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <xlocale.h>
+#endif
+#endif
+#endif
+
+#include "parallel.h"
+
+// Parsing of numbers in text files (Perseus and CSV).
+// Numbers are separated by white space or commas, and read by std::from_chars
+// (by strtod in the "C" locale where the standard library lacks it for double).
+
+namespace text_parser {
+
+inline bool is_separator(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+#if !defined(__cpp_lib_to_chars)
+// strtod independent of the locale of the process (the decimal point is always '.')
+inline double strtod_c(const char* s, char** s_end) {
+#if defined(_WIN32)
+	static const _locale_t c_locale = _create_locale(LC_NUMERIC, "C");
+	return _strtod_l(s, s_end, c_locale);
+#else
+	static const locale_t c_locale = newlocale(LC_NUMERIC_MASK, "C", static_cast<locale_t>(0));
+	return strtod_l(s, s_end, c_locale);
+#endif
+}
+#endif
+
+// read the number starting at p into v; returns the end of the number, or nullptr if there is none
+inline const char* parseDouble(const char* p, const char* end, double& v) {
+#if defined(__cpp_lib_to_chars)
+	const auto r = std::from_chars(p, end, v);
+	return (r.ec == std::errc()) ? r.ptr : nullptr;
+#else
+	// no floating-point std::from_chars (libc++): strtod on a NUL-terminated copy of the token,
+	// as [p, end) is not terminated
+	const char* q = p;
+	while (q < end && *q != '\n' && !is_separator(*q)) ++q;
+	const size_t n = static_cast<size_t>(q - p);
+	char small[64];
+	std::string large;
+	char* s = small;
+	if (n < sizeof(small)) {
+		std::memcpy(small, p, n);
+		small[n] = '\0';
+	} else {
+		large.assign(p, q);
+		s = &large[0];
+	}
+	char* s_end;
+	v = strtod_c(s, &s_end);
+	return (s_end == s) ? nullptr : p + (s_end - s);
+#endif
+}
+
+// parse the numbers of the lines in [p, end), appending them to out; returns the number of non-empty lines
+inline size_t parseLines(const char* p, const char* end, std::vector<double>& out) {
+	size_t rows = 0;
+	bool has_value = false;
+	while (p < end) {
+		const char c = *p;
+		if (c == '\n') {
+			rows += has_value;
+			has_value = false;
+			++p;
+		} else if (is_separator(c)) {
+			++p;
+		} else {
+			if (c == '+') ++p;
+			double v;
+			const char* next = parseDouble(p, end, v);
+			if (next == nullptr) {
+				throw std::runtime_error("Invalid number in the input: " + std::string(p, std::find(p, end, '\n')));
+			}
+			out.push_back(v);
+			has_value = true;
+			p = next;
+		}
+	}
+	return rows + has_value;
+}
+
+// Parse the numbers in [begin, end) into out (in order), splitting the text at line breaks
+// over num_threads threads; returns the number of non-empty lines
+inline size_t parseNumbers(const char* begin, const char* end, unsigned num_threads, std::vector<double>& out) {
+	const size_t n = static_cast<size_t>(end - begin);
+	std::vector<std::vector<double>> local(num_threads);
+	std::vector<size_t> rows(num_threads, 0);
+	std::vector<std::exception_ptr> errors(num_threads);
+	const unsigned nt = parallel_chunks(n, num_threads, [&](unsigned t, size_t b, size_t e) {
+		// a chunk consists of the lines starting in [b, e)
+		const char* p = begin + b;
+		const char* q = begin + e;
+		while (p > begin && p < end && p[-1] != '\n') ++p;
+		while (q < end && q[-1] != '\n') ++q;
+		try {
+			local[t].reserve(static_cast<size_t>(q - p) / 4);
+			rows[t] = parseLines(p, q, local[t]);
+		} catch (...) {
+			errors[t] = std::current_exception();
+		}
+	});
+	for (unsigned t = 0; t < nt; ++t) {
+		if (errors[t]) std::rethrow_exception(errors[t]);
+	}
+	if (nt == 1 && out.empty()) {
+		out.swap(local[0]);
+		return rows[0];
+	}
+	std::vector<size_t> offset(nt + 1, out.size());
+	size_t total_rows = 0;
+	for (unsigned t = 0; t < nt; ++t) {
+		offset[t + 1] = offset[t] + local[t].size();
+		total_rows += rows[t];
+	}
+	out.resize(offset[nt]);
+	parallel_chunks(nt, nt, [&](unsigned, size_t b, size_t e) {
+		for (size_t t = b; t < e; ++t) {
+			std::copy(local[t].begin(), local[t].end(), out.begin() + static_cast<std::ptrdiff_t>(offset[t]));
+			std::vector<double>().swap(local[t]);
+		}
+	});
+	return total_rows;
+}
+
+// the first line of [p, end) as [p, returned pointer), and the start of the next line
+inline const char* nextLine(const char* p, const char* end, const char*& line_end) {
+	line_end = std::find(p, end, '\n');
+	return (line_end < end) ? line_end + 1 : end;
+}
+
+} // namespace text_parser
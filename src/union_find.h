@@ -24,31 +24,42 @@ private:
 public:
 	vector<double> birthtime;
 	UnionFind(DenseCubicalGrids* _dcg);
+	// start over with the vertices of _dcg (reusing the storage when it has the same size)
+	void reset(DenseCubicalGrids* _dcg);
 	uint64_t find(uint64_t x);
 	void link(uint64_t x, uint64_t y);
 };
 
 UnionFind::UnionFind(DenseCubicalGrids* _dcg) {
-	uint64_t n = _dcg->ax * _dcg->ay * _dcg->az * _dcg->aw;
+	reset(_dcg);
+}
+
+void UnionFind::reset(DenseCubicalGrids* _dcg) {
+	// nodes are indexed by the voxel offset in the padded grid (see CubeLayout);
+	// the entries for the boundary are never linked
+	const CubeLayout &layout = _dcg->layout;
+	uint64_t n = layout.offset(_dcg->ax - 1, _dcg->ay - 1, _dcg->az - 1, _dcg->aw - 1) + 1;
 	parent.resize(n);
-	birthtime.resize(n);
-	time_max.resize(n);
+	birthtime.assign(n, _dcg->threshold);
 	//cout << n << " vertices" << endl;
+	for (uint64_t i = 0; i < n; ++i) {
+		parent[i] = i;
+	}
 
-	uint64_t i=0;
 	for (uint32_t w = 0; w < _dcg->aw; ++w) {
 		for (uint32_t z = 0; z < _dcg->az; ++z) {
 			for (uint32_t y = 0; y < _dcg->ay; ++y) {
+				if (!_dcg->rowActive(y, z, w)) continue; // never linked
+				uint64_t i = layout.offset(0, y, z, w);
 				for(uint32_t x = 0; x < _dcg->ax ; ++x){
-					parent[i] = i;
 					birthtime[i] = _dcg->getBirth(x,y,z,w,0,0);
-					time_max[i] = birthtime[i]; // maximum filtration value for the group
 					//cout << x << "," << y << "," << z << "," << w << ": " << birthtime[i] << endl;
 					i++;
 				}
 			}
 		}
 	}
+	time_max = birthtime; // maximum filtration value for the group
 }
 
 // find the root of a node x (specified by the index)
@@ -13,55 +13,80 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 #include <cstdint>
+#include <utility>
+#include <vector>
 #include "dense_cubical_grids.h"
+#include "parallel.h"
 
+// A persistence pair as recorded during the computation: the creator and destroyer cells
+// by their Cube::index (24 bytes, or 12 with COMPACT_CUBE).
+// The filtration values and the locations are looked up only when the pairs are written
+// (see resolvePairs).
 class WritePairs
 {
 public:
+	index_t birth_index;
+	index_t death_index;  // NONE for an essential class
+	uint8_t dim;
+	uint8_t birth_dim, death_dim; // dimensions of the creator and destroyer cells
+
+	WritePairs(uint8_t _dim, const Cube& _birthC, uint8_t _birth_dim, const Cube& _deathC, uint8_t _death_dim)
+		: birth_index(_birthC.index), death_index(_deathC.index), dim(_dim), birth_dim(_birth_dim), death_dim(_death_dim) {}
+
+	// essential class
+	WritePairs(uint8_t _dim, const Cube& _birthC, uint8_t _birth_dim)
+		: birth_index(_birthC.index), death_index(NONE), dim(_dim), birth_dim(_birth_dim), death_dim(0) {}
+};
+
+// A pair with its filtration values and the locations of the creator and destroyer voxels
+// in the input image (the locations are zero when not requested)
+struct ResolvedPair {
 	uint8_t dim;
 	double birth;
 	double death;
-	uint32_t birth_x,birth_y,birth_z,birth_w;
-	uint32_t death_x,death_y,death_z,death_w;
+	int64_t birth_x, birth_y, birth_z, birth_w;
+	int64_t death_x, death_y, death_z, death_w;
+};
 
-	WritePairs(uint8_t _dim, double _birth, double _death, uint32_t _birth_x,uint32_t _birth_y,uint32_t _birth_z, uint32_t _birth_w, uint32_t _death_x,uint32_t _death_y,uint32_t _death_z, uint32_t _death_w, bool print = false){
-        dim = _dim;
-        birth = _birth;
-        death = _death;
-        birth_x = _birth_x;
-        birth_y = _birth_y;
-        birth_z = _birth_z;
-        birth_w = _birth_w;
-        death_x = _death_x;
-        death_y = _death_y;
-        death_z = _death_z;
-        death_w = _death_w;
-        if (print == true) {
-            std::cout << "[" << birth << "," << death << ")" << " birth loc. (" << birth_x << "," << birth_y << "," << birth_z << "," << birth_w << "), " << " death loc. (" << death_x << "," << death_y << "," << death_z << "," << death_w << ")" << std::endl;
-        }
-    }
-    WritePairs(uint8_t _dim, Cube _birthC, Cube _deathC, DenseCubicalGrids* _dcg, bool print = false){
-        dim = _dim;
-        birth = _birthC.birth;
-        death = _deathC.birth;
-        auto b =  _dcg->ParentVoxel(dim, _birthC);
-        auto d =  _dcg->ParentVoxel(dim, _deathC);
-        birth_x=b[0];
-        birth_y=b[1];
-        birth_z=b[2];
-        birth_w=b[3];
-        death_x=d[0];
-        death_y=d[1];
-        death_z=d[2];
-        death_w=d[3];
-        if (print == true) {
-            //_birthC.print();
-            //_deathC.print();
-            if (_dcg->dim < 4)
-                std::cout << "[" << birth << "," << death << ")" << " birth loc. (" << birth_x << "," << birth_y << "," << birth_z << "), " << " death loc. (" << death_x << "," << death_y << "," << death_z << ")" << std::endl;
-            else
-                std::cout << "[" << birth << "," << death << ")" << " birth loc. (" << birth_x << "," << birth_y << "," << birth_z << "," << birth_w << "), " << " death loc. (" << death_x << "," << death_y << "," << death_z << "," << death_w << ")" << std::endl;
-        }
-    }
+// birth time of the cell of dimension d with the given index (the threshold for NONE)
+inline double cellBirth(DenseCubicalGrids* dcg, index_t index, uint8_t d) {
+	if (index == NONE) return dcg->threshold;
+	uint32_t x, y, z, w;
+	dcg->layout.decode(index, x, y, z, w);
+	return dcg->getBirth(x, y, z, w, Cube(0, index).m(), d);
+}
 
-};
+// Resolve the pairs [first, first + n) into out[0..n), splitting the work over num_threads.
+// The voxel search is skipped unless location is set.
+inline void resolvePairs(const WritePairs* first, size_t n, DenseCubicalGrids* dcg, bool location,
+		ResolvedPair* out, unsigned num_threads) {
+	// shift from the padded grid to the input image
+	const int64_t sx = int64_t(dcg->crop_x) - (dcg->ax - dcg->img_x) / 2;
+	const int64_t sy = int64_t(dcg->crop_y) - (dcg->ay - dcg->img_y) / 2;
+	const int64_t sz = int64_t(dcg->crop_z) - (dcg->az - dcg->img_z) / 2;
+	const int64_t sw = int64_t(dcg->crop_w) - ((dcg->dim < 4) ? 0 : (dcg->aw - dcg->img_w) / 2);
+	// under Alexander duality, the creator of a dual pair sits at the destroyer of the primal pair and vice versa
+	const bool dual = (dcg->config->method == ALEXANDER);
+	parallel_chunks(n, num_threads, [&](unsigned, size_t b, size_t e) {
+		for (size_t i = b; i < e; ++i) {
+			const WritePairs& p = first[i];
+			ResolvedPair& r = out[i];
+			r.dim = p.dim;
+			r.birth = dcg->filtrationValue(cellBirth(dcg, p.birth_index, p.birth_dim));
+			r.death = dcg->filtrationValue(cellBirth(dcg, p.death_index, p.death_dim));
+			r.birth_x = r.birth_y = r.birth_z = r.birth_w = 0;
+			r.death_x = r.death_y = r.death_z = r.death_w = 0;
+			if (!location) continue;
+			const auto bv = dcg->birthVoxel(p.birth_dim, Cube(0, p.birth_index));
+			r.birth_x = bv[0] + sx; r.birth_y = bv[1] + sy; r.birth_z = bv[2] + sz; r.birth_w = bv[3] + sw;
+			if (p.death_index != NONE) {
+				const auto dv = dcg->birthVoxel(p.death_dim, Cube(0, p.death_index));
+				r.death_x = dv[0] + sx; r.death_y = dv[1] + sy; r.death_z = dv[2] + sz; r.death_w = dv[3] + sw;
+			}
+			if (dual && p.dim > 0) {
+				swap(r.birth_x, r.death_x); swap(r.birth_y, r.death_y);
+				swap(r.birth_z, r.death_z); swap(r.birth_w, r.death_w);
+			}
+		}
+	});
+}
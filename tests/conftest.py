@@ -10,3 +10,32 @@ def build_python_modules():
     built = glob.glob('cripser/_cripser*.so') and glob.glob('tcripser*.so')
     if not built:
         subprocess.run([sys.executable, 'setup.py', 'build_ext', '--inplace'], check=True)
+
+
+@pytest.fixture(params=["V", "T"])
+def filtration(request):
+    return request.param
+
+
+# an image shape of each dimension
+@pytest.fixture(params=[(40,), (21, 17), (9, 8, 7), (5, 4, 6, 3)], ids=lambda s: "x".join(map(str, s)))
+def shape(request):
+    return request.param
+
+
+@pytest.fixture
+def assert_same_as_compute_ph():
+    """check(results, images, filtration="V", **kwargs): each result equals compute_ph of its image
+    (converted to a contiguous float64 array) with the same options."""
+    import numpy as np
+
+    import cripser
+
+    def check(results, images, filtration="V", **kwargs):
+        results, images = list(results), list(images)
+        assert len(results) == len(images)
+        for got, img in zip(results, images):
+            ref = cripser.compute_ph(np.ascontiguousarray(img, dtype=np.float64), filtration=filtration, **kwargs)
+            assert np.array_equal(got, ref)
+
+    return check
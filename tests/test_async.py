@@ -0,0 +1,50 @@
+import asyncio
+import concurrent.futures
+
+import numpy as np
+import pytest
+
+import cripser
+
+
+@pytest.mark.parametrize("filtration", ["V", "T"])
+def test_futures_match_compute_ph(filtration):
+    rng = np.random.default_rng(7)
+    images = [rng.random((30, 20 + i)) for i in range(12)]
+    futures = [cripser.compute_ph_async(img, filtration=filtration, maxdim=1) for img in images]
+    assert all(isinstance(f, concurrent.futures.Future) for f in futures)
+    for img, f in zip(images, futures):
+        assert np.array_equal(f.result(timeout=60), cripser.compute_ph(img, filtration=filtration, maxdim=1))
+
+
+def test_bounded_queue():
+    cripser.set_async_pool(num_workers=2, max_queue=1)
+    try:
+        rng = np.random.default_rng(8)
+        images = [rng.random((12, 12, 12)) for _ in range(10)]
+        # submissions block while the queue is full, and all complete
+        futures = [cripser.computePH_async(img) for img in images]
+        results = [f.result(timeout=60) for f in concurrent.futures.as_completed(futures)]
+        assert len(results) == len(images)
+    finally:
+        cripser.set_async_pool()
+
+
+def test_asyncio():
+    rng = np.random.default_rng(9)
+    images = [rng.random((25, 25)) for _ in range(6)]
+
+    async def main():
+        return await asyncio.gather(*(asyncio.wrap_future(cripser.compute_ph_async(img, maxdim=1)) for img in images))
+
+    for img, ph in zip(images, asyncio.run(main())):
+        assert np.array_equal(ph, cripser.compute_ph(img, maxdim=1))
+
+
+def test_errors():
+    # invalid arguments are reported at once, errors of the computation through the future
+    with pytest.raises(ValueError):
+        cripser.compute_ph_async(np.zeros((2, 2, 2, 2, 2)))
+    f = cripser.compute_ph_async(np.zeros((8, 8)), filtration="T", top_dim=True)
+    with pytest.raises(ValueError):
+        f.result(timeout=60)
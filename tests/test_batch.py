@@ -0,0 +1,37 @@
+import numpy as np
+import pytest
+
+import cripser
+
+
+def _images(ph, offsets):
+    return [ph[offsets[i]:offsets[i + 1]] for i in range(len(offsets) - 1)]
+
+
+def test_batch_matches_single(filtration, shape, assert_same_as_compute_ph):
+    rng = np.random.default_rng(0)
+    stack = rng.random((7,) + shape)
+    stack[3] = np.round(stack[3] * 4)  # ties
+
+    ph, offsets = cripser.compute_ph_batch(stack, filtration=filtration, maxdim=3, threads=3)
+
+    assert offsets.shape == (len(stack) + 1,)
+    assert offsets[-1] == len(ph)
+    assert_same_as_compute_ph(_images(ph, offsets), stack, filtration, maxdim=3)
+
+
+def test_batch_strided_stack(assert_same_as_compute_ph):
+    rng = np.random.default_rng(1)
+    base = rng.random((12, 14, 11))
+    # every other image, and images that are not contiguous themselves
+    for stack in [base[::2], base[::-3, :, ::2], base.transpose(2, 0, 1)]:
+        ph, offsets = cripser.compute_ph_batch(stack, threads=2)
+        assert_same_as_compute_ph(_images(ph, offsets), stack)
+
+
+def test_batch_empty_and_invalid():
+    ph, offsets = cripser.computePH_batch(np.zeros((0, 8, 8)))
+    assert ph.shape == (0, 9)
+    assert list(offsets) == [0]
+    with pytest.raises(ValueError):
+        cripser.computePH_batch(np.zeros(8))
@@ -0,0 +1,46 @@
+import signal
+import subprocess
+from pathlib import Path
+
+import numpy as np
+import pytest
+
+resource = pytest.importorskip('resource')  # file size limits (POSIX)
+
+
+def cubicalripser():
+    exe = Path('build') / 'cubicalripser'
+    if not exe.exists():
+        # Try to build the binary if not present
+        subprocess.run(['make', '-C', 'build', 'cubicalripser'], check=True)
+    return str(exe)
+
+
+def test_failure_in_a_later_dimension_keeps_the_earlier_ones(tmp_path):
+    img = np.random.RandomState(1).rand(12, 12, 12)
+    npy_path = tmp_path / 'img.npy'
+    np.save(npy_path, img)
+
+    # the pairs of dims 0 and 1
+    ref = tmp_path / 'ref.csv'
+    subprocess.run([cubicalripser(), '-m', '1', '-o', str(ref), str(npy_path)], check=True, capture_output=True)
+    earlier = ref.read_bytes()
+
+    out = tmp_path / 'out.csv'
+    out.write_text('previous output\n')
+
+    # the file cannot grow beyond dims 0 and 1, so writing dim 2 fails as on a full disk
+    def limit_file_size():
+        resource.setrlimit(resource.RLIMIT_FSIZE, (len(earlier) + 10, len(earlier) + 10))
+        signal.signal(signal.SIGXFSZ, signal.SIG_IGN)
+
+    proc = subprocess.run([cubicalripser(), '-m', '2', '-o', str(out), str(npy_path)],
+                          capture_output=True, text=True, preexec_fn=limit_file_size)
+    assert proc.returncode != 0
+
+    partial = tmp_path / 'out.csv.partial'
+    assert str(partial) in proc.stderr
+    assert partial.read_bytes().startswith(earlier)
+    # the previous output is not replaced
+    assert out.read_text() == 'previous output\n'
+    assert not (tmp_path / 'out.csv.tmp').exists()
@@ -0,0 +1,112 @@
+import ctypes
+
+import numpy as np
+import pytest
+
+import cripser
+
+
+class DLPackTensor:
+    """A minimal producer: exposes a numpy array only through the DLPack protocol."""
+
+    def __init__(self, arr):
+        self._arr = arr
+
+    def __dlpack__(self, *args, **kwargs):
+        return self._arr.__dlpack__(*args, **kwargs)
+
+    def __dlpack_device__(self):
+        return self._arr.__dlpack_device__()
+
+
+class _DLDevice(ctypes.Structure):
+    _fields_ = [("device_type", ctypes.c_int32), ("device_id", ctypes.c_int32)]
+
+
+class _DLDataType(ctypes.Structure):
+    _fields_ = [("code", ctypes.c_uint8), ("bits", ctypes.c_uint8), ("lanes", ctypes.c_uint16)]
+
+
+class _DLTensor(ctypes.Structure):
+    _fields_ = [("data", ctypes.c_void_p), ("device", _DLDevice), ("ndim", ctypes.c_int32), ("dtype", _DLDataType),
+                ("shape", ctypes.POINTER(ctypes.c_int64)), ("strides", ctypes.POINTER(ctypes.c_int64)),
+                ("byte_offset", ctypes.c_uint64)]
+
+
+class _DLManagedTensor(ctypes.Structure):
+    _fields_ = [("dl_tensor", _DLTensor), ("manager_ctx", ctypes.c_void_p), ("deleter", ctypes.c_void_p)]
+
+
+class RawDLPackTensor:
+    """A producer of a float64 DLTensor made by hand: the element (i, j, ...) is at
+    base[first + i * strides[0] + j * strides[1] + ...], reported to be on the given device."""
+
+    def __init__(self, base, first, shape, strides, device_type=1):
+        assert base.dtype == np.float64 and base.flags.c_contiguous
+        self._base = base  # keeps the memory alive
+        self._shape = (ctypes.c_int64 * len(shape))(*shape)
+        self._strides = (ctypes.c_int64 * len(shape))(*strides)
+        self._managed = _DLManagedTensor()
+        t = self._managed.dl_tensor
+        t.data = base.ctypes.data
+        t.byte_offset = first * base.itemsize
+        t.device = _DLDevice(device_type, 0)
+        t.ndim = len(shape)
+        t.dtype = _DLDataType(2, 64, 1)  # float64
+        t.shape = self._shape
+        t.strides = self._strides
+        self._device_type = device_type
+
+    def __dlpack__(self, *args, **kwargs):
+        new_capsule = ctypes.pythonapi.PyCapsule_New
+        new_capsule.restype = ctypes.py_object
+        new_capsule.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+        return new_capsule(ctypes.addressof(self._managed), b"dltensor", None)
+
+    def __dlpack_device__(self):
+        return (self._device_type, 0)
+
+
+@pytest.mark.parametrize("dtype", [np.float64, np.float32, np.uint8, np.int16, np.int64])
+def test_dlpack_input(dtype, filtration, shape, assert_same_as_compute_ph):
+    img = (np.random.default_rng(0).random(shape) * 50).astype(dtype)
+    assert_same_as_compute_ph([cripser.compute_ph(DLPackTensor(img), filtration=filtration)], [img], filtration)
+
+
+def test_dlpack_strided():
+    rng = np.random.default_rng(1)
+    base = rng.random((30, 24, 10))
+    for view in [base[::2, 1::3, 4], base.transpose(2, 0, 1)[:, ::3, ::2], np.asfortranarray(base)[:, :, ::2]]:
+        ref = cripser.computePH(np.ascontiguousarray(view))
+        assert np.array_equal(cripser.computePH(DLPackTensor(view)), ref)
+        # numpy arrays are read with their strides as well
+        assert np.array_equal(cripser.computePH(view), ref)
+
+
+def test_dlpack_raw_tensor(assert_same_as_compute_ph):
+    base = np.random.default_rng(3).random(12 * 10)
+    # the transpose of base.reshape(12, 10), starting at its second row
+    tensor = RawDLPackTensor(base, 10, (10, 11), (1, 10))
+    assert_same_as_compute_ph([cripser.compute_ph(tensor)], [base.reshape(12, 10)[1:].T])
+
+
+def test_dlpack_negative_strides_raise():
+    base = np.random.default_rng(4).random(12 * 10)
+    # base.reshape(12, 10)[::-1]
+    with pytest.raises(ValueError):
+        cripser.compute_ph(RawDLPackTensor(base, 110, (12, 10), (-10, 1)))
+
+
+def test_dlpack_other_device_raises():
+    base = np.random.default_rng(5).random(12 * 10)
+    with pytest.raises(ValueError):
+        cripser.compute_ph(RawDLPackTensor(base, 0, (12, 10), (10, 1), device_type=2))  # CUDA
+
+
+def test_dlpack_batch():
+    rng = np.random.default_rng(2)
+    stack = rng.random((5, 20, 16)).astype(np.float32)[:, ::2, :]
+    ph, offsets = cripser.compute_ph_batch(DLPackTensor(stack), threads=2)
+    ref, ref_offsets = cripser.compute_ph_batch(np.ascontiguousarray(stack, dtype=np.float64))
+    assert np.array_equal(ph, ref)
+    assert np.array_equal(offsets, ref_offsets)
@@ -0,0 +1,45 @@
+import numpy as np
+import pytest
+
+import cripser
+
+DTYPES = [np.float64, np.float32, np.bool_, np.uint8, np.int8, np.uint16, np.int16,
+          np.uint32, np.int32, np.uint64, np.int64]
+
+
+def _image(dtype, shape, rng):
+    if dtype == np.bool_:
+        return rng.random(shape) > 0.5
+    if np.issubdtype(dtype, np.floating):
+        return (rng.random(shape) * 10 - 5).astype(dtype)
+    info = np.iinfo(dtype)
+    return rng.integers(max(info.min, -100), min(info.max, 100), size=shape, endpoint=True).astype(dtype)
+
+
+@pytest.mark.parametrize("dtype", DTYPES)
+def test_native_dtype_matches_float64(dtype, filtration, shape, assert_same_as_compute_ph):
+    img = _image(dtype, shape, np.random.default_rng(0))
+    # the values of the input are used as they are (float32 values are exact in float64)
+    results = [cripser.compute_ph(a, filtration=filtration) for a in (img, np.asfortranarray(img))]
+    assert_same_as_compute_ph(results, [img, img], filtration)
+
+
+@pytest.mark.parametrize("dtype", DTYPES)
+def test_native_dtype_batch(dtype):
+    rng = np.random.default_rng(1)
+    stack = _image(dtype, (4, 16, 15), rng)
+    ph, offsets = cripser.compute_ph_batch(stack)
+    ref, ref_offsets = cripser.compute_ph_batch(stack.astype(np.float64))
+    assert np.array_equal(ph, ref)
+    assert np.array_equal(offsets, ref_offsets)
+
+
+def test_converted_dtypes():
+    rng = np.random.default_rng(2)
+    img = rng.random((12, 11))
+    ref = cripser.computePH(img)
+    # non-contiguous views are read in place, and other byte orders and dtypes are converted
+    assert np.array_equal(cripser.computePH(np.repeat(img, 2, axis=1)[:, ::2]), ref)
+    assert np.array_equal(cripser.computePH(img.astype(img.dtype.newbyteorder())), ref)
+    assert np.array_equal(cripser.computePH(img.astype(np.float16)), cripser.computePH(img.astype(np.float16).astype(np.float64)))
+    assert np.array_equal(cripser.computePH(img.tolist()), ref)
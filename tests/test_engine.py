@@ -0,0 +1,102 @@
+import threading
+
+import numpy as np
+import pytest
+
+import cripser
+
+
+def test_engine_matches_compute_ph(filtration, shape, assert_same_as_compute_ph):
+    rng = np.random.default_rng(11)
+    engine = cripser.Engine(shape, maxdim=3, construction=filtration)
+    assert engine.shape == shape
+    # float and few-level images in turn
+    images = [rng.random(shape) if i % 2 == 0 else rng.integers(0, 5, shape).astype(np.uint8) for i in range(4)]
+    assert_same_as_compute_ph([engine.compute(img) for img in images], images, filtration, maxdim=3)
+
+
+def test_engine_after_an_error(filtration, assert_same_as_compute_ph):
+    rng = np.random.default_rng(16)
+    shape = (14, 13, 6)
+    engine = cripser.Engine(shape, maxdim=2, construction=filtration)
+    images = [rng.random(shape) for _ in range(3)]
+
+    def stop(dim, rows):
+        raise KeyError(dim)
+
+    results = []
+    for img in images:
+        # a computation stopped by its callback, then one of the same and of another image
+        with pytest.raises(KeyError):
+            engine.compute(img, on_pairs=stop)
+        results.append(engine.compute(img))
+    with pytest.raises(ValueError):
+        engine.compute(np.zeros((14, 13)))
+    results.append(engine.compute(images[0]))
+    assert_same_as_compute_ph(results, images + images[:1], filtration, maxdim=2)
+
+
+def test_engine_settings():
+    rng = np.random.default_rng(12)
+    img = rng.random((20, 20))
+    options = dict(location="none", threshold=0.7, method="compute_pairs", cache_size="auto")
+    engine = cripser.Engine(img.shape, maxdim=1, **options)
+    for _ in range(2):
+        assert np.array_equal(engine.compute(img), cripser.compute_ph(img, maxdim=1, **options))
+    engine = cripser.Engine(img.shape, maxdim=1, top_dim=True)
+    assert np.array_equal(engine.compute(img), cripser.compute_ph(img, maxdim=1, top_dim=True))
+
+
+def test_engine_strided_and_on_pairs():
+    rng = np.random.default_rng(13)
+    img = rng.random((30, 40)).T  # Fortran order
+    engine = cripser.Engine(img.shape, maxdim=1)
+    received = []
+    ph = engine.compute(img, on_pairs=lambda dim, rows: received.append(rows))
+    assert np.array_equal(ph, cripser.compute_ph(np.ascontiguousarray(img), maxdim=1))
+    assert np.array_equal(np.concatenate(received), ph)
+
+
+def test_engine_shape_mismatch():
+    engine = cripser.Engine((10, 10), maxdim=1)
+    with pytest.raises(ValueError):
+        engine.compute(np.zeros((10, 11)))
+    with pytest.raises(ValueError):
+        engine.compute(np.zeros((10, 10, 1)))
+
+
+def test_engine_per_thread():
+    rng = np.random.default_rng(14)
+    images = [rng.random((16, 16, 16)) for _ in range(8)]
+    expected = [cripser.compute_ph(img, maxdim=2) for img in images]
+    results = [[None] * len(images) for _ in range(4)]
+
+    def work(t):
+        engine = cripser.Engine((16, 16, 16), maxdim=2, threads=1)
+        for i, img in enumerate(images):
+            results[t][i] = engine.compute(img)
+
+    threads = [threading.Thread(target=work, args=(t,)) for t in range(4)]
+    for th in threads:
+        th.start()
+    for th in threads:
+        th.join()
+    for r in results:
+        for got, want in zip(r, expected):
+            assert np.array_equal(got, want)
+
+
+def test_engine_reentry_from_on_pairs_raises():
+    img = np.random.default_rng(15).random((12, 12))
+    engine = cripser.Engine(img.shape, maxdim=1)
+    errors = []
+
+    def on_pairs(dim, rows):
+        try:
+            engine.compute(img)
+        except RuntimeError as e:
+            errors.append(e)
+
+    ph = engine.compute(img, on_pairs=on_pairs)
+    assert errors
+    assert np.array_equal(ph, cripser.compute_ph(img, maxdim=1))
@@ -0,0 +1,35 @@
+import numpy as np
+import pytest
+
+import cripser
+
+
+def _strip_essential_death(pd, ncoord):
+    # the death location of an essential class carries no information
+    pd = pd.copy()
+    pd[pd[:, 2] >= np.finfo(np.float64).max, 3 + ncoord:] = 0
+    return pd
+
+
+@pytest.mark.parametrize("filtration", ["V", "T"])
+@pytest.mark.parametrize("shape", [(40, 37), (13, 11, 9), (6, 5, 7, 4)])
+def test_mask_matches_excluded_voxels(filtration, shape):
+    rng = np.random.default_rng(0)
+    img = rng.random(shape)
+    grid = np.indices(shape)
+    r = sum(((g - 0.6 * s) / (0.35 * s)) ** 2 for g, s in zip(grid, shape))
+    mask = (r < 1) & (rng.random(shape) > 0.1)
+
+    pd_mask = cripser.compute_ph(img, filtration=filtration, mask=mask)
+    # masked voxels behave as if they never enter the filtration
+    ref = np.where(mask, img, np.finfo(np.float64).max)
+    pd_ref = cripser.compute_ph(ref, filtration=filtration)
+
+    ncoord = 3 if len(shape) < 4 else 4
+    assert np.array_equal(_strip_essential_death(pd_mask, ncoord), _strip_essential_death(pd_ref, ncoord))
+
+
+def test_mask_shape_mismatch():
+    img = np.zeros((8, 8))
+    with pytest.raises(ValueError):
+        cripser.computePH(img, mask=np.ones((8, 7)))
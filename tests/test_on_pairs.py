@@ -0,0 +1,35 @@
+import numpy as np
+import pytest
+
+import cripser
+
+
+@pytest.mark.parametrize("filtration", ["V", "T"])
+@pytest.mark.parametrize("method", ["link_find", "compute_pairs"])
+def test_on_pairs_delivers_each_dimension(filtration, method):
+    arr = np.random.default_rng(4).random((12, 11, 10))
+    calls = []
+    ph = cripser.compute_ph(arr, filtration=filtration, maxdim=2, method=method,
+                            on_pairs=lambda dim, rows: calls.append((dim, rows)))
+    assert [dim for dim, _ in calls] == [0, 1, 2]
+    for dim, rows in calls:
+        assert rows.shape[1] == 9
+        assert np.all(rows[:, 0] == dim)
+    assert np.array_equal(np.concatenate([rows for _, rows in calls]), ph)
+
+
+def test_on_pairs_top_dim_and_location_none():
+    arr = np.random.default_rng(5).random((20, 20))
+    calls = []
+    ph = cripser.compute_ph(arr, top_dim=True, location="none",
+                            on_pairs=lambda dim, rows: calls.append(rows))
+    assert np.array_equal(np.concatenate(calls), ph)
+    assert ph.shape[1] == 3
+
+
+def test_on_pairs_exception_propagates():
+    def fail(dim, rows):
+        raise RuntimeError("stop")
+
+    with pytest.raises(RuntimeError, match="stop"):
+        cripser.compute_ph(np.random.default_rng(6).random((10, 10)), on_pairs=fail)
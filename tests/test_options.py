@@ -0,0 +1,62 @@
+import numpy as np
+import pytest
+
+import cripser
+
+
+def _volume():
+    rng = np.random.default_rng(3)
+    return rng.random((14, 12, 10))
+
+
+def test_threshold_keeps_pairs_born_below():
+    arr = _volume()
+    full = cripser.compute_ph(arr, maxdim=2)
+    ph = cripser.compute_ph(arr, maxdim=2, threshold=0.5)
+    assert np.all(ph[:, 1] <= 0.5)
+    # pairs dying below the threshold are unchanged
+    key = lambda a: a[np.lexsort(a.T[::-1])]
+    assert np.array_equal(key(ph[ph[:, 2] < 0.5]), key(full[full[:, 2] < 0.5]))
+
+
+@pytest.mark.parametrize("filtration", ["V", "T"])
+def test_location_none(filtration):
+    arr = _volume()
+    full = cripser.compute_ph(arr, filtration=filtration, maxdim=2)
+    ph = cripser.compute_ph(arr, filtration=filtration, maxdim=2, location="none")
+    assert ph.shape == (len(full), 3)
+    assert np.array_equal(ph, full[:, :3])
+    ph_b, offsets = cripser.compute_ph_batch(np.stack([arr, arr]), filtration=filtration, maxdim=2, location="none")
+    assert ph_b.shape == (2 * len(full), 3)
+
+
+@pytest.mark.parametrize("cache", [
+    dict(cache_size=0),
+    dict(cache_size=5, min_recursion_to_cache=2),
+    dict(cache_size="auto"),
+    dict(cache_size="auto", memory_budget=0.01),
+])
+def test_cache_settings_do_not_change_result(cache):
+    arr = _volume()
+    ref = cripser.compute_ph(arr, maxdim=2)
+    assert np.array_equal(cripser.compute_ph(arr, maxdim=2, **cache), ref)
+
+
+def test_compute_pairs_matches_link_find():
+    arr = _volume()
+    ref = cripser.compute_ph(arr, maxdim=2)
+    ph = cripser.compute_ph(arr, maxdim=2, method="compute_pairs", cache_size="auto")
+    key = lambda a: a[np.lexsort(a.T[::-1])]
+    assert np.array_equal(key(ph), key(ref))
+
+
+def test_invalid_options():
+    arr = _volume()
+    with pytest.raises(ValueError):
+        cripser.compute_ph(arr, method="ripser")
+    with pytest.raises(ValueError):
+        cripser.compute_ph(arr, location="maybe")
+    with pytest.raises(ValueError):
+        cripser.compute_ph(arr, cache_size="big")
+    with pytest.raises(ValueError):
+        cripser.compute_ph(arr, cache_size="auto", memory_budget=0)
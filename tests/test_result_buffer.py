@@ -0,0 +1,37 @@
+import gc
+
+import numpy as np
+import pytest
+
+import cripser
+
+
+@pytest.mark.parametrize("filtration", ["V", "T"])
+def test_result_is_a_plain_writable_array(filtration):
+    arr = np.random.default_rng(5).random((30, 25))
+    ph = cripser.compute_ph(arr, filtration=filtration, maxdim=1)
+    # the rows are handed over to numpy without a copy: the array does not own its buffer
+    assert not ph.flags.owndata
+    assert ph.flags.c_contiguous and ph.flags.writeable
+    assert ph.dtype == np.float64 and ph.shape[1] == 9
+    ref = ph.copy()
+    del arr
+    gc.collect()
+    ph[:, 0] += 0  # still valid and writable
+    assert np.array_equal(ph, ref)
+
+
+def test_empty_result():
+    ph, offsets = cripser.compute_ph_batch(np.zeros((0, 4, 4)))
+    assert ph.shape == (0, 9) and list(offsets) == [0]
+
+
+def test_batch_rows_in_image_order():
+    rng = np.random.default_rng(6)
+    # images of very different sizes of output finish out of order on the threads
+    stack = rng.random((16, 40, 40))
+    stack[::3] = 0.5
+    ph, offsets = cripser.compute_ph_batch(stack, maxdim=1, threads=4)
+    assert not ph.flags.owndata
+    for i, img in enumerate(stack):
+        assert np.array_equal(ph[offsets[i]:offsets[i + 1]], cripser.compute_ph(img, maxdim=1))
@@ -0,0 +1,20 @@
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+import pytest
+
+import cripser
+
+
+@pytest.mark.parametrize("filtration", ["V", "T"])
+def test_concurrent_compute_ph_matches_sequential(filtration):
+    rng = np.random.default_rng(0)
+    imgs = [rng.random(shape) for shape in [(64, 64), (20, 18, 16), (8, 7, 6, 5)] * 4]
+    expected = [cripser.compute_ph(img, filtration=filtration) for img in imgs]
+
+    # computePH releases the GIL, so the calls overlap
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        results = list(pool.map(lambda img: cripser.compute_ph(img, filtration=filtration), imgs))
+
+    for pd, ref in zip(results, expected):
+        assert np.array_equal(pd, ref)
@@ -5,6 +5,7 @@ from cripser import (
     to_gudhi_diagrams,
     to_gudhi_persistence,
     group_by_dim,
+    to_structured,
 )
 
 
@@ -32,3 +33,18 @@ def test_utils_converters_basic():
     assert len(groups) >= 1
     if len(groups[0]) > 0:
         assert np.all(groups[0][:, 0] == 0)
+
+
+def test_to_structured():
+    rng = np.random.default_rng(0)
+    ph = compute_ph(rng.random((12, 10, 8)), maxdim=2)
+    st = to_structured(ph)
+    assert st.shape == (ph.shape[0],)
+    assert st.dtype["dim"] == np.uint8 and st.dtype["x1"] == np.int16
+    assert st.dtype.itemsize == 1 + 2 * 8 + 6 * 2
+    assert np.array_equal(st["birth"], ph[:, 1]) and np.array_equal(st["death"], ph[:, 2])
+    assert np.array_equal(st["z2"], ph[:, 8])
+
+    st32 = to_structured(ph, float32=True)
+    assert st32.dtype["birth"] == np.float32
+    assert np.isinf(st32["death"][ph[:, 2] >= np.finfo(np.float64).max]).all()